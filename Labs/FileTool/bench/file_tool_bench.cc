@@ -0,0 +1,674 @@
+/**
+* @File file_tool_bench.cc
+* @Date 2023-04-20
+* @Description FileTool 各种读写方式的基准测试，输出吞吐量、IOPS 和延迟分位数，可保存为 JSON 用于版本间对比
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "parse_args.h"
+#include "file_tool.h"
+#include "file_copy.h"
+#include "mapped_file.h"
+#include "line_mapper.h"
+#include "direct_io.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const size_t kBlockSize = size_t(1) << 20;     // 顺序读写每次的大小
+    const size_t kRandomSize = 4096;                // 随机读写每次的大小
+    const size_t kSyncOpsLimit = 2000;              // 每次写入都同步时最多测试的次数
+
+    struct Config
+    {
+        std::string path {"file_tool_bench.dat"};
+        size_t size {size_t(2048) << 20};
+        size_t ops {20000};             // 随机读写的次数
+        std::set<std::string> groups;   // 为空时运行全部测试
+        std::string json;
+        std::string label;
+        bool keep {false};              // 保留测试文件，下次运行时大小足够则直接使用
+    };
+
+    struct Result
+    {
+        std::string group;
+        std::string name;
+        uint64_t bytes {0};
+        uint64_t ops {0};
+        double seconds {0};
+        std::vector<double> latencies;  // 每次操作的耗时，微秒，只统计吞吐量的测试为空
+        std::string note;
+
+        Result(std::string _group, std::string _name)
+            : group(std::move(_group))
+            , name(std::move(_name))
+        {}
+    };
+
+    class Args : public ParseArgs
+    {
+    protected:
+        void onUsage() const override
+        {
+            std::cout << "Usage ./FileToolBench [options]\n"
+                      << "-h    --help               show the usage\n"
+                      << "-f    --file=str           test file path, default file_tool_bench.dat\n"
+                      << "-s    --size=int           test file size in MB, default 2048\n"
+                      << "-n    --ops=int            random read/write count, default 20000\n"
+                      << "-g    --group=str          comma separated groups: seq_read,rand_read,lines,write,copy\n"
+                      << "-j    --json=str           write results as JSON to the file\n"
+                      << "-l    --label=str          label stored in JSON, e.g. the git revision\n"
+                      << "-k    --keep               keep the test file and reuse it next time\n";
+        }
+        std::vector<Option> onOptions() override
+        {
+            return {
+                    {"help",  kNoArg,  'h', true },
+                    {"file",  kReqArg, 'f', true },
+                    {"size",  kReqArg, 's', true },
+                    {"ops",   kReqArg, 'n', true },
+                    {"group", kReqArg, 'g', true },
+                    {"json",  kReqArg, 'j', true },
+                    {"label", kReqArg, 'l', true },
+                    {"keep",  kNoArg,  'k', true },
+            };
+        }
+        std::pair<std::string, AnyType> onParseArg(int code, std::string arg) override
+        {
+            switch (code) {
+                case 'h':
+                    return { "help", {} };
+                case 'f':
+                    return { "file", std::move(arg) };
+                case 's':
+                    return { "size", size_t(std::stoull(arg)) };
+                case 'n':
+                    return { "ops", size_t(std::stoull(arg)) };
+                case 'g':
+                    return { "group", std::move(arg) };
+                case 'j':
+                    return { "json", std::move(arg) };
+                case 'l':
+                    return { "label", std::move(arg) };
+                case 'k':
+                    return { "keep", {} };
+                default:
+                    return {"", {} };
+            }
+        }
+    };
+
+    double elapsedMicros(Clock::time_point _start, Clock::time_point _end)
+    {
+        return std::chrono::duration<double, std::micro>(_end - _start).count();
+    }
+
+    std::string sizeName(size_t _size)
+    {
+        return _size >= (1 << 20) ? std::to_string(_size >> 20) + "m" : std::to_string(_size >> 10) + "k";
+    }
+
+    // 有权限时清空整个页缓存，否则只丢弃测试文件的缓存，返回使用的方式
+    std::string dropFileCaches(const std::vector<std::string>& _paths)
+    {
+        ::sync();
+        int fd = ::open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            bool ok = ::write(fd, "3", 1) == 1;
+            ::close(fd);
+            if (ok) {
+                return "drop_caches";
+            }
+        }
+        for (auto& path : _paths) {
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                ::posix_fadvise64(fd, 0, 0, POSIX_FADV_DONTNEED);
+                ::close(fd);
+            }
+        }
+        return "fadvise";
+    }
+
+    class Bench
+    {
+    public:
+        explicit Bench(const Config& _config)
+            : _config(_config)
+            , _out_path(_config.path + ".out")
+        {}
+
+        bool run();
+        bool writeJson() const;
+
+    private:
+        bool enabled(const std::string& _group) const {
+            return this->_config.groups.empty() || this->_config.groups.count(_group) != 0;
+        }
+        void dropCaches() {
+            this->_cache_mode = dropFileCaches({this->_config.path, this->_out_path});
+        }
+        // 重复调用 _op 直到返回 0 或达到 _max_ops 次，记录每次的耗时，_op 返回本次处理的字节数
+        template<typename Op>
+        void measure(Result& _result, size_t _max_ops, Op&& _op);
+        // 只记录总耗时，ops 由 _op 自己统计，默认为一次
+        template<typename Op>
+        void measureOnce(Result& _result, Op&& _op);
+        void add(Result&& _result);
+
+        bool prepare();
+        std::vector<size_t> randomOffsets(size_t _count) const;
+
+        void benchSeqRead();
+        void benchRandRead();
+        void benchLines();
+        void benchWrite();
+        void benchCopy();
+
+    private:
+        Config _config;
+        std::string _out_path;
+        std::string _cache_mode {"none"};
+        std::vector<Result> _results;
+
+    }; // Bench
+
+    template<typename Op>
+    void Bench::measure(Result& _result, size_t _max_ops, Op&& _op)
+    {
+        auto start = Clock::now();
+        auto last = start;
+        while (_result.ops < _max_ops) {
+            size_t len = _op(_result.ops);
+            if (len == 0) {
+                break;
+            }
+            auto now = Clock::now();
+            _result.latencies.push_back(elapsedMicros(last, now));
+            _result.bytes += len;
+            ++_result.ops;
+            last = now;
+        }
+        _result.seconds = elapsedMicros(start, last) / 1e6;
+    }
+
+    template<typename Op>
+    void Bench::measureOnce(Result& _result, Op&& _op)
+    {
+        auto start = Clock::now();
+        _result.bytes = _op();
+        _result.ops = std::max(_result.ops, uint64_t(1));
+        _result.seconds = elapsedMicros(start, Clock::now()) / 1e6;
+    }
+
+    void Bench::add(Result&& _result)
+    {
+        auto& r = _result;
+        double mbps = r.seconds > 0 ? double(r.bytes) / (1 << 20) / r.seconds : 0;
+        double iops = r.seconds > 0 ? double(r.ops) / r.seconds : 0;
+        printf("%-10s %-18s %10.1f MB/s", r.group.c_str(), r.name.c_str(), mbps);
+        if (r.ops > 1) {
+            printf(" %12.0f IOPS", iops);
+        } else {
+            printf(" %17s", "");
+        }
+        if (!r.latencies.empty()) {
+            std::sort(r.latencies.begin(), r.latencies.end());
+            auto pct = [&r](double _p) {
+                return r.latencies[std::min(r.latencies.size() - 1, size_t(_p * double(r.latencies.size())))];
+            };
+            printf("   p50 %9.1f  p99 %9.1f  p99.9 %9.1f  max %9.1f us", pct(0.5), pct(0.99), pct(0.999), r.latencies.back());
+        }
+        if (!r.note.empty()) {
+            printf("   (%s)", r.note.c_str());
+        }
+        printf("\n");
+        fflush(stdout);
+        this->_results.push_back(std::move(_result));
+    }
+
+    // 生成由随机长度的行组成的文本文件，行的内容对测试没有影响
+    bool Bench::prepare()
+    {
+        auto& path = this->_config.path;
+        if (this->_config.keep && File::isExist(path.c_str())
+            && size_t(FileStat::of(path.c_str(), FileStat::kSize).size()) >= this->_config.size) {
+            this->_config.size = size_t(FileStat::of(path.c_str(), FileStat::kSize).size());
+            return true;
+        }
+        ::unlink(path.c_str());
+        FileWriter writer(File::create(path, 0644), kBlockSize);
+        if (!writer) {
+            fprintf(stderr, "create %s error: %s\n", path.c_str(), writer.file().errorMsg());
+            return false;
+        }
+        std::vector<char> chunk(kBlockSize);
+        uint64_t state = 0x9e3779b97f4a7c15ULL;
+        size_t line_left = 0;
+        for (size_t written = 0; written < this->_config.size; ) {
+            size_t len = std::min(chunk.size(), this->_config.size - written);
+            for (size_t i = 0; i < len; ++i) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                if (line_left == 0) {
+                    chunk[i] = '\n';
+                    line_left = 16 + state % 128;
+                } else {
+                    chunk[i] = char('a' + state % 26);
+                    --line_left;
+                }
+            }
+            if (writer.write(chunk.data(), len) != len) {
+                fprintf(stderr, "write %s error: %s\n", path.c_str(), writer.file().errorMsg());
+                return false;
+            }
+            written += len;
+        }
+        writer.flush();
+        return writer.pending() == 0;
+    }
+
+    std::vector<size_t> Bench::randomOffsets(size_t _count) const
+    {
+        // 固定种子，不同版本访问相同的位置
+        std::mt19937_64 rng(20230420);
+        size_t blocks = std::max(size_t(1), this->_config.size / kRandomSize);
+        std::vector<size_t> offsets(_count);
+        for (auto& offset : offsets) {
+            offset = size_t(rng() % blocks) * kRandomSize;
+        }
+        return offsets;
+    }
+
+    void Bench::benchSeqRead()
+    {
+        auto& path = this->_config.path;
+        for (size_t buf_size : {size_t(4) << 10, size_t(64) << 10, kBlockSize}) {
+            Result result {"seq_read", "read_" + sizeName(buf_size)};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly));
+            File& file = file_reader.file();
+            std::vector<File::byte> buf(buf_size);
+            this->measure(result, SIZE_MAX, [&](size_t) {
+                return file.readBytes(buf.data(), buf.size());
+            });
+            this->add(std::move(result));
+        }
+        {
+            Result result {"seq_read", "pread_1m"};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly));
+            File& file = file_reader.file();
+            std::vector<File::byte> buf(kBlockSize);
+            this->measure(result, SIZE_MAX, [&](size_t _index) {
+                return file.multiReadBytes(buf.data(), _index * kBlockSize, kBlockSize);
+            });
+            this->add(std::move(result));
+        }
+        {
+            // 拷贝到缓冲区，和 read 处理的数据量一致
+            Result result {"seq_read", "mmap_1m"};
+            this->dropCaches();
+            auto mapped = MappedFile::map(path);
+            std::vector<char> buf(kBlockSize);
+            this->measure(result, SIZE_MAX, [&](size_t _index) {
+                size_t offset = _index * kBlockSize;
+                size_t len = offset < mapped.size() ? std::min(kBlockSize, mapped.size() - offset) : 0;
+                std::memcpy(buf.data(), mapped.data() + offset, len);
+                return len;
+            });
+            this->add(std::move(result));
+        }
+        {
+            Result result {"seq_read", "o_direct_1m"};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly | File::kDirect));
+            File& file = file_reader.file();
+            DirectIO::Options options;
+            options.queue_depth = 1;
+            DirectIO dio(options);
+            AlignedBuffer buf(kBlockSize);
+            result.note = file.isDirect() ? "" : "O_DIRECT unsupported, buffered";
+            this->measure(result, SIZE_MAX, [&](size_t _index) {
+                return dio.read(file, buf.data(), _index * kBlockSize, kBlockSize);
+            });
+            this->add(std::move(result));
+        }
+        {
+            // 默认队列深度，读取下一批的同时处理当前批
+            Result result {"seq_read", "o_direct_scan"};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly | File::kDirect));
+            File& file = file_reader.file();
+            DirectIO dio;
+            result.note = file.isDirect() ? "" : "O_DIRECT unsupported, buffered";
+            // 同一批的块连续回调，单个块的耗时没有意义，只统计吞吐量
+            this->measureOnce(result, [&]() {
+                dio.scan(file, [&](off64_t, const File::byte*, size_t _size) {
+                    result.bytes += _size;
+                    ++result.ops;
+                    return true;
+                });
+                return result.bytes;
+            });
+            this->add(std::move(result));
+        }
+    }
+
+    void Bench::benchRandRead()
+    {
+        auto& path = this->_config.path;
+        auto offsets = this->randomOffsets(this->_config.ops);
+        std::string name_suffix = "_" + sizeName(kRandomSize);
+        {
+            Result result {"rand_read", "pread" + name_suffix};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly));
+            File& file = file_reader.file();
+            std::vector<File::byte> buf(kRandomSize);
+            this->measure(result, offsets.size(), [&](size_t _index) {
+                return file.multiReadBytes(buf.data(), offsets[_index], kRandomSize);
+            });
+            this->add(std::move(result));
+        }
+        {
+            Result result {"rand_read", "mmap" + name_suffix};
+            this->dropCaches();
+            auto mapped = MappedFile::map(path);
+            std::vector<char> buf(kRandomSize);
+            this->measure(result, offsets.size(), [&](size_t _index) {
+                size_t len = std::min(kRandomSize, mapped.size() - offsets[_index]);
+                std::memcpy(buf.data(), mapped.data() + offsets[_index], len);
+                return len;
+            });
+            this->add(std::move(result));
+        }
+        {
+            Result result {"rand_read", "o_direct" + name_suffix};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly | File::kDirect));
+            File& file = file_reader.file();
+            DirectIO::Options options;
+            options.queue_depth = 1;
+            DirectIO dio(options);
+            AlignedBuffer buf(kRandomSize);
+            result.note = file.isDirect() ? "" : "O_DIRECT unsupported, buffered";
+            this->measure(result, offsets.size(), [&](size_t _index) {
+                return dio.read(file, buf.data(), offsets[_index], kRandomSize);
+            });
+            this->add(std::move(result));
+        }
+    }
+
+    void Bench::benchLines()
+    {
+        auto& path = this->_config.path;
+        {
+            // 单线程基准：read 读入缓冲区后用 memchr 找换行
+            Result result {"lines", "read_memchr"};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly));
+            File& file = file_reader.file();
+            std::vector<char> buf(kBlockSize);
+            size_t lines = 0;
+            this->measureOnce(result, [&]() {
+                size_t total = 0;
+                size_t len;
+                char last = '\n';
+                while ((len = file.readBytes((File::bytePtr)buf.data(), buf.size())) > 0) {
+                    const char* end = buf.data() + len;
+                    for (const char* p = buf.data(); (p = (const char*)std::memchr(p, '\n', size_t(end - p))) != nullptr; ++p) {
+                        ++lines;
+                    }
+                    last = end[-1];
+                    total += len;
+                }
+                // 最后一行没有换行符
+                lines += last != '\n';
+                return total;
+            });
+            result.ops = lines;
+            this->add(std::move(result));
+        }
+        for (bool use_mmap : {true, false}) {
+            Result result {"lines", use_mmap ? "line_mapper_mmap" : "line_mapper_pread"};
+            this->dropCaches();
+            FileReader file_reader(File::open(path, File::kReadOnly));
+            File& file = file_reader.file();
+            LineMapper::Options options;
+            options.use_mmap = use_mmap;
+            LineMapper mapper(options);
+            size_t lines = 0;
+            this->measureOnce(result, [&]() {
+                lines = mapper.mapReduce(file, size_t(0),
+                    [](size_t& _count, const LineView&) { ++_count; },
+                    [](size_t& _total, size_t&& _part) { _total += _part; });
+                return this->_config.size;
+            });
+            result.ops = lines;
+            this->add(std::move(result));
+        }
+    }
+
+    void Bench::benchWrite()
+    {
+        std::vector<char> chunk(kBlockSize, 'x');
+        for (bool sync : {false, true}) {
+            Result result {"write", sync ? "seq_1m_fsync" : "seq_1m"};
+            this->dropCaches();
+            ::unlink(this->_out_path.c_str());
+            FileWriter writer(File::create(this->_out_path, 0644), kBlockSize);
+            this->measure(result, this->_config.size / kBlockSize, [&](size_t) {
+                return writer.write(chunk.data(), chunk.size());
+            });
+            if (sync) {
+                // 最后一次 fsync 计入总耗时
+                auto start = Clock::now();
+                writer.flush();
+                writer.file().flush();
+                result.seconds += elapsedMicros(start, Clock::now()) / 1e6;
+            }
+            this->add(std::move(result));
+        }
+
+        // 在上面写出的文件中随机覆盖写
+        auto offsets = this->randomOffsets(this->_config.ops);
+        std::string name_suffix = "_" + sizeName(kRandomSize);
+        for (bool sync : {false, true}) {
+            Result result {"write", sync ? "rand" + name_suffix + "_fdatasync" : "rand" + name_suffix};
+            this->dropCaches();
+            FileWriter file_writer(File::open(this->_out_path, File::kReadWrite));
+            File& file = file_writer.file();
+            size_t max_ops = sync ? std::min(kSyncOpsLimit, offsets.size()) : offsets.size();
+            this->measure(result, max_ops, [&](size_t _index) {
+                size_t len = file.multiWriteBytes((File::bytePtr)chunk.data(), offsets[_index], kRandomSize);
+                if (sync) {
+                    file.flushData();
+                }
+                return len;
+            });
+            this->add(std::move(result));
+        }
+    }
+
+    void Bench::benchCopy()
+    {
+        const std::pair<int, const char*> strategies[] = {
+            {FileCopier::kCopyFileRange, "copy_file_range"},
+            {FileCopier::kSendFile, "sendfile"},
+            {FileCopier::kSplice, "splice"},
+            {FileCopier::kBuffered, "buffered"},
+        };
+        for (auto& strategy : strategies) {
+            Result result {"copy", strategy.second};
+            ::unlink(this->_out_path.c_str());
+            this->dropCaches();
+            FileReader src_reader(File::open(this->_config.path, File::kReadOnly));
+            File& src = src_reader.file();
+            FileWriter dst_writer(File::create(this->_out_path, 0644));
+            File& dst = dst_writer.file();
+            // 单线程拷贝，只比较拷贝方式本身
+            FileCopier::Options options;
+            options.strategy = strategy.first;
+            options.thread_count = 1;
+            FileCopier copier(options);
+            this->measureOnce(result, [&]() {
+                return copier.copy(src, dst);
+            });
+            if (result.bytes != this->_config.size) {
+                result.note = "incomplete";
+            }
+            this->add(std::move(result));
+        }
+    }
+
+    bool Bench::run()
+    {
+        printf(">> file: %s, size: %zu MB\n", this->_config.path.c_str(), this->_config.size >> 20);
+        if (!this->prepare()) {
+            return false;
+        }
+        if (this->enabled("seq_read")) {
+            this->benchSeqRead();
+        }
+        if (this->enabled("rand_read")) {
+            this->benchRandRead();
+        }
+        if (this->enabled("lines")) {
+            this->benchLines();
+        }
+        if (this->enabled("write")) {
+            this->benchWrite();
+        }
+        if (this->enabled("copy")) {
+            this->benchCopy();
+        }
+        printf(">> page cache dropped by: %s\n", this->_cache_mode.c_str());
+
+        ::unlink(this->_out_path.c_str());
+        if (!this->_config.keep) {
+            ::unlink(this->_config.path.c_str());
+        }
+        return true;
+    }
+
+    std::string jsonString(const std::string& _str)
+    {
+        std::string out = "\"";
+        for (char ch : _str) {
+            if (ch == '"' || ch == '\\') {
+                out.push_back('\\');
+                out.push_back(ch);
+            } else if ((unsigned char)ch < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                out.append(buf);
+            } else {
+                out.push_back(ch);
+            }
+        }
+        out.push_back('"');
+        return out;
+    }
+
+    bool Bench::writeJson() const
+    {
+        std::ostringstream out;
+        out << "{\n"
+            << "  \"label\": " << jsonString(this->_config.label) << ",\n"
+            << "  \"timestamp\": " << std::time(nullptr) << ",\n"
+            << "  \"file_size\": " << this->_config.size << ",\n"
+            << "  \"cache_drop\": " << jsonString(this->_cache_mode) << ",\n"
+            << "  \"results\": [";
+        for (size_t i = 0; i < this->_results.size(); ++i) {
+            auto& r = this->_results[i];
+            out << (i == 0 ? "\n" : ",\n")
+                << "    {\"group\": " << jsonString(r.group)
+                << ", \"name\": " << jsonString(r.name)
+                << ", \"bytes\": " << r.bytes
+                << ", \"ops\": " << r.ops
+                << ", \"seconds\": " << r.seconds
+                << ", \"mb_per_sec\": " << (r.seconds > 0 ? double(r.bytes) / (1 << 20) / r.seconds : 0)
+                << ", \"iops\": " << (r.seconds > 0 && r.ops > 1 ? double(r.ops) / r.seconds : 0)
+                << ", \"latency_us\": ";
+            if (r.latencies.empty()) {
+                out << "null";
+            } else {
+                // latencies 已在 add 中排序
+                auto pct = [&r](double _p) {
+                    return r.latencies[std::min(r.latencies.size() - 1, size_t(_p * double(r.latencies.size())))];
+                };
+                out << "{\"p50\": " << pct(0.5) << ", \"p90\": " << pct(0.9) << ", \"p99\": " << pct(0.99)
+                    << ", \"p999\": " << pct(0.999) << ", \"max\": " << r.latencies.back() << "}";
+            }
+            out << ", \"note\": " << jsonString(r.note) << "}";
+        }
+        out << "\n  ]\n}\n";
+
+        std::string content = out.str();
+        ::unlink(this->_config.json.c_str());
+        FileWriter writer(File::create(this->_config.json, 0644));
+        if (!writer || writer.write(content) != content.size()) {
+            return false;
+        }
+        writer.flush();
+        return writer.pending() == 0;
+    }
+}
+
+int main(int argc, char* const* argv)
+{
+    auto args = ParseArgs::Init<Args>(argc, argv);
+    if (args->has("help")) {
+        args->showHelp();
+        return 0;
+    }
+    Config config;
+    if (args->has("file")) {
+        config.path = args->get<std::string>("file");
+    }
+    if (args->has("size")) {
+        config.size = std::max(size_t(1), args->get<size_t>("size")) << 20;
+    }
+    if (args->has("ops")) {
+        config.ops = std::max(size_t(1), args->get<size_t>("ops"));
+    }
+    if (args->has("group")) {
+        std::istringstream groups(args->get<std::string>("group"));
+        std::string group;
+        while (std::getline(groups, group, ',')) {
+            config.groups.insert(group);
+        }
+    }
+    if (args->has("json")) {
+        config.json = args->get<std::string>("json");
+    }
+    if (args->has("label")) {
+        config.label = args->get<std::string>("label");
+    }
+    config.keep = args->has("keep");
+
+    Bench bench(config);
+    if (!bench.run()) {
+        return 1;
+    }
+    if (!config.json.empty() && !bench.writeJson()) {
+        fprintf(stderr, "write json %s error\n", config.json.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+* @File page_cache_bench.cc
+* @Date 2023-04-12
+* @Description 对比普通读写与流式读写的吞吐量和页缓存占用
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_tool.h"
+#include "mapped_file.h"
+#include <sys/mman.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+    const size_t kChunkSize = size_t(1) << 20;
+
+    // 统计文件在页缓存中的页数
+    size_t residentPages(const std::string& _path)
+    {
+        auto mapped = MappedFile::map(_path);
+        if (mapped.size() == 0) {
+            return 0;
+        }
+        size_t page_size = size_t(::sysconf(_SC_PAGESIZE));
+        std::vector<unsigned char> pages((mapped.size() + page_size - 1) / page_size);
+        size_t count = 0;
+        if (::mincore((void*)mapped.data(), mapped.size(), pages.data()) == 0) {
+            for (auto page : pages) {
+                count += page & 1;
+            }
+        }
+        return count;
+    }
+
+    // 清空文件在页缓存中的内容，脏页需要先写回
+    void dropCache(const std::string& _path)
+    {
+        int fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ::fdatasync(fd);
+            ::posix_fadvise64(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+
+    double elapsedSeconds(std::chrono::steady_clock::time_point _start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+    void report(const char* _name, size_t _bytes, double _seconds, size_t _pages)
+    {
+        size_t page_size = size_t(::sysconf(_SC_PAGESIZE));
+        printf("%-16s %10.1f MB/s  resident %8.1f MB\n", _name,
+               double(_bytes) / (1 << 20) / _seconds, double(_pages * page_size) / (1 << 20));
+    }
+
+    void benchWrite(const std::string& _path, size_t _size, bool _streaming)
+    {
+        ::unlink(_path.c_str());
+        std::vector<char> chunk(kChunkSize, 'x');
+        auto start = std::chrono::steady_clock::now();
+        {
+            FileWriter writer(File::create(_path, 0644), kChunkSize, FileWriter::kSyncData);
+            if (_streaming) {
+                writer.setStreaming();
+            }
+            for (size_t written = 0; written < _size; written += chunk.size()) {
+                writer.write(chunk.data(), chunk.size());
+            }
+        }
+        report(_streaming ? "write streaming" : "write normal", _size, elapsedSeconds(start), residentPages(_path));
+    }
+
+    void benchRead(const std::string& _path, bool _streaming)
+    {
+        dropCache(_path);
+        std::vector<char> chunk(kChunkSize);
+        size_t total = 0;
+        auto start = std::chrono::steady_clock::now();
+        {
+            FileReader reader(File::open(_path, File::kReadOnly));
+            if (_streaming) {
+                reader.setStreaming();
+            }
+            size_t len;
+            while ((len = reader.readRecords(chunk.data(), chunk.size())) > 0) {
+                total += len;
+            }
+        }
+        report(_streaming ? "read streaming" : "read normal", total, elapsedSeconds(start), residentPages(_path));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "page_cache_bench.dat";
+    size_t size_mb = argc > 2 ? size_t(std::strtoul(argv[2], nullptr, 10)) : 1024;
+    size_t size = size_mb << 20;
+    printf(">> file: %s, size: %zu MB\n", path.c_str(), size_mb);
+
+    benchWrite(path, size, false);
+    benchWrite(path, size, true);
+    benchRead(path, false);
+    benchRead(path, true);
+
+    ::unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+* @File arena.h
+* @Date 2023-04-21
+* @Description 指针递增的内存池，逐个分配、一起释放，重置后内存块重复使用
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_ARENA_H
+#define __LINUX_STUDY_FILE_TOOL_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class Arena
+{
+public:
+    static const size_t kDefaultBlockSize = 64 * 1024;
+
+    explicit Arena(size_t _block_size = kDefaultBlockSize)
+        : _block_size(_block_size == 0 ? kDefaultBlockSize : _block_size)
+    {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator = (const Arena&) = delete;
+    Arena(Arena&&) noexcept = default;
+    Arena& operator = (Arena&&) noexcept = default;
+
+    // 分配 _size 字节，地址按 _align 对齐，_align 需要是 2 的幂
+    // 当前块放不下时使用下一块，大于块大小的分配单独使用一块
+    char* allocate(size_t _size, size_t _align = 1);
+    // 分配并拷贝 _data
+    char* copy(const void* _data, size_t _size);
+    // 之前分配的内存全部失效，内存块保留下来，之后的分配不再向系统申请
+    void reset() {
+        this->_current = 0;
+        this->_offset = 0;
+        this->_used = 0;
+    }
+
+    // 重置以来分配出去的字节数
+    size_t used() const {
+        return this->_used;
+    }
+    // 持有的全部内存块大小
+    size_t capacity() const;
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t _block_size;
+    std::vector<Block> _blocks;
+    size_t _current {0};    // 正在使用的块
+    size_t _offset {0};     // 当前块中已分配的位置
+    size_t _used {0};
+
+}; // Arena
+
+#endif // __LINUX_STUDY_FILE_TOOL_ARENA_H
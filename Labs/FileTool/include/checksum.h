@@ -0,0 +1,89 @@
+/**
+* @File checksum.h
+* @Date 2023-04-12
+* @Description 文件校验和，CRC32C（支持时使用硬件指令）和 64 位非加密哈希
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_CHECKSUM_H
+#define __LINUX_STUDY_FILE_TOOL_CHECKSUM_H
+
+#include "file_tool.h"
+#include <cstdint>
+
+// CRC32C (Castagnoli)，x86 上支持 SSE4.2 时使用 crc32 指令
+class Crc32c
+{
+public:
+    // 在 _crc 基础上继续计算 _data 的校验和
+    static uint32_t compute(const void* _data, size_t _size, uint32_t _crc = 0);
+    // 已知 A 和 B 的校验和，计算 A + B 的校验和，_len2 为 B 的长度
+    static uint32_t combine(uint32_t _crc1, uint32_t _crc2, size_t _len2);
+    // _count 个 0 字节的校验和，不需要逐字节计算
+    static uint32_t zeros(size_t _count);
+    // 是否使用硬件指令
+    static bool hardwareSupported();
+
+    struct FileOptions
+    {
+        unsigned thread_count {0};              // 0 表示按 CPU 核心数
+        size_t chunk_size {size_t(4) << 20};    // 每次计算的块大小
+        bool use_mmap {true};                   // 使用内存映射读取，否则使用 pread
+    };
+    // 计算整个文件的校验和，大文件分段并行计算后合并
+    static uint32_t ofFile(const File& _file, const FileOptions& _options);
+    static uint32_t ofFile(const File& _file) {
+        return Crc32c::ofFile(_file, FileOptions());
+    }
+
+public:
+    Crc32c() = default;
+    explicit Crc32c(uint32_t _crc)
+        : _crc(_crc)
+    {}
+
+    // 流式计算
+    void update(const void* _data, size_t _size) {
+        this->_crc = Crc32c::compute(_data, _size, this->_crc);
+    }
+    uint32_t value() const {
+        return this->_crc;
+    }
+    void reset() {
+        this->_crc = 0;
+    }
+
+private:
+    uint32_t _crc {0};
+
+}; // Crc32c
+
+// 64 位非加密哈希，算法与 xxHash64 相同
+class Hash64
+{
+public:
+    static uint64_t compute(const void* _data, size_t _size, uint64_t _seed = 0);
+    // 顺序读取整个文件计算哈希
+    static uint64_t ofFile(const File& _file, uint64_t _seed = 0);
+
+public:
+    explicit Hash64(uint64_t _seed = 0) {
+        this->reset(_seed);
+    }
+
+    void reset(uint64_t _seed = 0);
+    void update(const void* _data, size_t _size);
+    uint64_t digest() const;
+
+private:
+    uint64_t _acc[4];
+    uint64_t _seed;
+    uint64_t _total {0};
+    File::byte _buf[32];
+    size_t _buf_len {0};
+
+}; // Hash64
+
+#endif // __LINUX_STUDY_FILE_TOOL_CHECKSUM_H
@@ -0,0 +1,153 @@
+/**
+* @File dir_walker.h
+* @Date 2023-04-09
+* @Description 多线程递归遍历目录树
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_DIR_WALKER_H
+#define __LINUX_STUDY_FILE_TOOL_DIR_WALKER_H
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 遍历时的一个目录项，只在回调期间有效
+struct DirEntry
+{
+    int dir_fd;                     // 父目录描述符，可以配合 openat/fstatat 使用
+    const std::string* dir_path;    // 父目录路径
+    const char* name;               // 文件名
+    ino64_t ino;                    // inode 编号
+    unsigned char type;             // 文件类型，DT_REG、DT_DIR 等
+    unsigned depth;                 // 深度，根目录下的文件为 0
+    const struct stat64* stat;      // 文件信息，只有需要时才会获取，否则为 nullptr
+
+    bool isDirectory() const {
+        return this->type == DT_DIR;
+    }
+    bool isRegularFile() const {
+        return this->type == DT_REG;
+    }
+    // 拼接完整路径
+    std::string path() const;
+
+}; // DirEntry
+
+class DirWalker
+{
+public:
+    // 回调会在多个线程中同时调用，对目录返回 false 表示不进入该目录
+    typedef std::function<bool(const DirEntry&)> Callback;
+
+    struct Options
+    {
+        unsigned thread_count {0};      // 工作线程数，0 表示按 CPU 核心数
+        unsigned max_depth {~0u};       // 最大遍历深度
+        bool follow_links {false};      // 是否跟随指向目录的符号链接，链接回到祖先目录时不再进入
+        bool stat_entries {false};      // 是否为每一项获取 stat 信息
+    };
+
+public:
+    DirWalker() = default;
+    explicit DirWalker(const Options& _options)
+        : _options(_options)
+    {}
+
+    DirWalker(const DirWalker&) = delete;
+    DirWalker& operator = (const DirWalker&) = delete;
+
+    // 遍历 _root 下的所有文件，返回遍历到的文件数量
+    size_t walk(const std::string& _root, const Callback& _callback);
+    // 在回调中调用，尽快结束遍历
+    void stop() {
+        this->_stop.store(true);
+    }
+    // 打开或读取失败的目录数量
+    size_t errorCount() const {
+        return this->_error_count.load();
+    }
+    // 第一个失败的错误码，例如描述符用完时为 EMFILE，该目录下的子树没有遍历
+    int error() const {
+        return this->_error.load();
+    }
+    // 跟随符号链接时发现的循环数量，这些目录没有再次进入
+    size_t loopCount() const {
+        return this->_loop_count.load();
+    }
+
+private:
+    // 已经打开的目录，最后一个子目录打开后关闭
+    struct DirHandle
+    {
+        int fd;
+        explicit DirHandle(int _fd) : fd(_fd) {}
+        ~DirHandle() {
+            if (this->fd >= 0) {
+                ::close(this->fd);
+            }
+        }
+    };
+
+    // 跟随符号链接时记录的祖先目录，子目录和祖先是同一个目录时说明出现了循环
+    struct DirNode
+    {
+        dev_t dev;
+        ino64_t ino;
+        std::shared_ptr<const DirNode> parent;
+    };
+
+    // 等待遍历的目录
+    struct Task
+    {
+        std::shared_ptr<DirHandle> parent;  // 父目录，为空时使用 path 打开
+        std::string name;                   // 相对父目录的名称
+        std::string path;                   // 完整路径
+        unsigned depth;
+        std::shared_ptr<const DirNode> ancestors;   // 只在跟随符号链接时使用
+    };
+
+    // 每个线程一个任务队列，自己从尾部取，其他线程从头部窃取
+    struct TaskQueue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+private:
+    void workerLoop(size_t _index);
+    void processDir(size_t _index, Task& _task, std::vector<char>& _buf);
+    void pushTask(size_t _index, Task&& _task);
+    void setError(int _error);
+    bool popTask(size_t _index, Task& _task);
+    bool stealTask(size_t _index, Task& _task);
+
+private:
+    Options _options;
+    const Callback* _callback {nullptr};
+    std::vector<std::unique_ptr<TaskQueue>> _queues;
+    std::atomic<size_t> _pending {0};       // 未完成的目录数量，包括正在处理的
+    std::atomic<size_t> _queued {0};        // 队列中等待的目录数量
+    std::atomic<size_t> _idle {0};          // 空闲线程数量
+    std::atomic<size_t> _entry_count {0};
+    std::atomic<size_t> _error_count {0};
+    std::atomic<size_t> _loop_count {0};
+    std::atomic<int> _error {0};
+    std::atomic<bool> _stop {false};
+    std::mutex _idle_lock;
+    std::condition_variable _idle_cond;
+
+}; // DirWalker
+
+#endif // __LINUX_STUDY_FILE_TOOL_DIR_WALKER_H
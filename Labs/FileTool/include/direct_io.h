@@ -0,0 +1,94 @@
+/**
+* @File direct_io.h
+* @Date 2023-04-19
+* @Description O_DIRECT 读写，自动处理不对齐的头尾，并用多个线程同时发起请求
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_DIRECT_IO_H
+#define __LINUX_STUDY_FILE_TOOL_DIRECT_IO_H
+
+#include "file_tool.h"
+#include <functional>
+
+// 按指定对齐分配的内存，O_DIRECT 读写的缓冲区需要按块对齐
+class AlignedBuffer
+{
+public:
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t _size, size_t _align = File::kDirectAlign);
+    ~AlignedBuffer();
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator = (const AlignedBuffer&) = delete;
+    AlignedBuffer(AlignedBuffer&& _buf) noexcept
+        : _data(_buf._data)
+        , _size(_buf._size)
+        , _align(_buf._align)
+    {
+        _buf._data = nullptr;
+        _buf._size = 0;
+    }
+    AlignedBuffer& operator = (AlignedBuffer&& _buf) noexcept;
+
+    explicit operator bool() const {
+        return this->_data != nullptr;
+    }
+    File::byte* data() const {
+        return this->_data;
+    }
+    size_t size() const {
+        return this->_size;
+    }
+    size_t alignment() const {
+        return this->_align;
+    }
+    // 大小向上取整到对齐的整数倍，需要扩大时重新分配，原有内容不保留
+    bool reserve(size_t _size);
+
+private:
+    File::byte* _data {nullptr};
+    size_t _size {0};
+    size_t _align {File::kDirectAlign};
+
+}; // AlignedBuffer
+
+class DirectIO
+{
+public:
+    struct Options
+    {
+        size_t block_size {size_t(1) << 20};    // 每个请求的大小，对齐到 alignment
+        unsigned queue_depth {4};       // 同时进行的请求数，每个请求一个线程
+        size_t alignment {File::kDirectAlign};
+    };
+
+    // 顺序扫描的回调，_data 只在回调期间有效，返回 false 停止
+    typedef std::function<bool(off64_t _offset, const File::byte* _data, size_t _size)> ScanCallback;
+
+public:
+    DirectIO() : DirectIO(Options()) {}
+    explicit DirectIO(const Options& _options);
+
+    // 读取 [_offset, _offset + _count)，缓冲区、偏移和长度都可以不对齐，返回读取的字节数
+    // 对齐的部分直接读入 _buf，不对齐的头尾经过临时缓冲区
+    size_t read(const File& _file, void* _buf, size_t _offset, size_t _count) const;
+    // 写入 [_offset, _offset + _count)，不对齐的头尾块先读出再合并写回，写入后文件大小和普通写入一致
+    // 头尾块需要读出原有内容但文件只写打开时返回 0，errno 为 EBADF；原有内容读取失败的块不写入
+    size_t write(const File& _file, const void* _buf, size_t _offset, size_t _count) const;
+    // 从头到尾顺序读取整个文件，读取下一批数据的同时处理当前这批
+    bool scan(const File& _file, const ScanCallback& _callback) const;
+
+private:
+    // 将 [_start, _end) 按块切分，在多个线程中处理，_start 和 _end 已经对齐
+    template<typename Func>
+    void forEachPiece(size_t _start, size_t _end, Func&& _func) const;
+
+private:
+    Options _options;
+
+}; // DirectIO
+
+#endif // __LINUX_STUDY_FILE_TOOL_DIRECT_IO_H
@@ -0,0 +1,107 @@
+/**
+* @File file_cache.h
+* @Date 2023-04-17
+* @Description 按路径和打开标志缓存已经打开的文件，避免热点路径上反复 open/close
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_FILE_CACHE_H
+#define __LINUX_STUDY_FILE_TOOL_FILE_CACHE_H
+
+#include "file_tool.h"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class FileCache
+{
+public:
+    // 共享的文件句柄，多个线程同时使用时只能调用 multiReadBytes 等不依赖文件偏移的方法
+    // 被淘汰或失效后已经取出的句柄仍然有效，最后一个句柄释放时关闭文件
+    typedef std::shared_ptr<const File> Handle;
+
+    struct Options
+    {
+        size_t capacity {0};            // 最多缓存的文件数，0 表示取进程文件描述符上限的一半
+        unsigned shard_count {16};      // 分片数量，每个分片一把锁
+        bool watch_changes {false};     // 使用 inotify 监视所在目录，文件被删除或重命名时自动失效
+    };
+
+public:
+    FileCache() : FileCache(Options()) {}
+    explicit FileCache(const Options& _options);
+    ~FileCache();
+
+    FileCache(const FileCache&) = delete;
+    FileCache& operator = (const FileCache&) = delete;
+
+    // 获取打开的文件，不在缓存中时打开并放入缓存，打开失败返回 nullptr，errno 为错误原因
+    Handle open(const std::string& _path, int _flags = File::kReadOnly);
+    // 使路径的所有缓存失效，文件被删除或重命名后需要调用
+    void invalidate(const std::string& _path);
+    void clear();
+
+    size_t size() const;
+    size_t capacity() const {
+        return this->_capacity;
+    }
+    size_t hitCount() const {
+        return this->_hit_count.load();
+    }
+    size_t missCount() const {
+        return this->_miss_count.load();
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string path;
+        Handle file;
+    };
+
+    // 每个分片一个 LRU 链表，链表头部为最近使用的
+    struct Shard
+    {
+        std::mutex lock;
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+private:
+    Shard& shardOf(const std::string& _path);
+    // 从分片中移除一项，返回下一项，需要持有分片的锁
+    std::list<Entry>::iterator eraseEntry(Shard& _shard, std::list<Entry>::iterator _it);
+    // 目录中缓存的条目数加一，没有监视时添加
+    void watchDir(const std::string& _path);
+    // 目录中缓存的条目数减一，最后一项移除时删除监视
+    void unwatchDir(const std::string& _path);
+    void watchLoop();
+
+private:
+    Options _options;
+    size_t _capacity {0};
+    size_t _shard_capacity {0};
+    std::vector<std::unique_ptr<Shard>> _shards;
+    std::atomic<size_t> _hit_count {0};
+    std::atomic<size_t> _miss_count {0};
+
+    // inotify 监视
+    int _inotify_fd {-1};
+    int _event_fd {-1};
+    std::mutex _watch_lock;
+    std::unordered_map<std::string, int> _dir_watches;
+    std::unordered_map<int, std::string> _watch_dirs;
+    std::unordered_map<std::string, size_t> _dir_refs;     // 每个目录中缓存的条目数
+    std::thread _watch_thread;
+
+}; // FileCache
+
+#endif // __LINUX_STUDY_FILE_TOOL_FILE_CACHE_H
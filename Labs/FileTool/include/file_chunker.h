@@ -0,0 +1,82 @@
+/**
+* @File file_chunker.h
+* @Date 2023-04-16
+* @Description 基于内容的变长分块（FastCDC），以及只重写变化块的增量同步
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_FILE_CHUNKER_H
+#define __LINUX_STUDY_FILE_TOOL_FILE_CHUNKER_H
+
+#include "file_tool.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// 文件中的一个块，同时使用 xxHash64 和 CRC32C 判断内容是否相同
+struct FileChunk
+{
+    off64_t offset;
+    uint32_t length;
+    uint32_t crc;
+    uint64_t hash;
+
+    bool sameContent(const FileChunk& _other) const {
+        return this->length == _other.length && this->hash == _other.hash && this->crc == _other.crc;
+    }
+
+}; // FileChunk
+
+class FileChunker
+{
+public:
+    struct Options
+    {
+        size_t min_size {size_t(2) << 10};      // 块的最小大小，前面的字节不计算滚动哈希
+        size_t avg_size {size_t(8) << 10};      // 期望的平均大小，需要是 2 的幂
+        size_t max_size {size_t(64) << 10};     // 块的最大大小
+        size_t buffer_size {size_t(4) << 20};   // 读取文件的缓冲区大小
+    };
+
+    // 增量同步的统计
+    struct SyncStats
+    {
+        size_t chunk_count {0};         // 源文件的块数量
+        size_t changed_count {0};       // 重写的块数量
+        uint64_t written_bytes {0};     // 写入目标文件的字节数
+        uint64_t reused_bytes {0};      // 目标文件中保留不动的字节数
+    };
+
+    // 每一块的回调，_data 只在回调期间有效，返回 false 停止
+    typedef std::function<bool(const FileChunk& _chunk, const File::byte* _data)> ChunkCallback;
+
+public:
+    FileChunker() : FileChunker(Options()) {}
+    explicit FileChunker(const Options& _options);
+
+    // 在 [_data, _data + _size) 中查找第一个切分点，返回第一块的长度
+    size_t cutPoint(const File::byte* _data, size_t _size) const;
+    // 对一块内存分块，块的偏移从 _base 开始计算
+    std::vector<FileChunk> chunk(const void* _data, size_t _size, off64_t _base = 0) const;
+    // 顺序读取整个文件并分块
+    std::vector<FileChunk> chunkFile(const File& _file) const;
+    bool forEachChunk(const File& _file, const ChunkCallback& _callback) const;
+
+    // 使 _target 的内容与 _source 相同，只用 pwrite 重写目标文件中同一位置内容不同的块
+    // 前面的内容相同时分块边界一致，插入或删除只影响附近的块，但之后的块偏移改变仍需要重写
+    // 目标需要可读写打开，任一文件没有打开或读取失败时返回 false，源文件没有全部同步时不截断目标
+    bool deltaSync(const File& _source, const File& _target, SyncStats* _stats = nullptr) const;
+
+private:
+    FileChunk makeChunk(const File::byte* _data, size_t _size, off64_t _offset) const;
+
+private:
+    Options _options;
+    uint64_t _mask_small;   // 平均大小之前使用的掩码，更难切分
+    uint64_t _mask_large;   // 平均大小之后使用的掩码，更容易切分
+
+}; // FileChunker
+
+#endif // __LINUX_STUDY_FILE_TOOL_FILE_CHUNKER_H
@@ -0,0 +1,72 @@
+/**
+* @File file_copy.h
+* @Date 2023-04-08
+* @Description 文件拷贝工具，尽量在内核中完成数据拷贝
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_FILE_COPY_H
+#define __LINUX_STUDY_FILE_TOOL_FILE_COPY_H
+
+#include "file_tool.h"
+#include "checksum.h"
+
+class FileCopier
+{
+public:
+    // 拷贝方式，按从上到下的顺序依次尝试
+    enum : int {
+        kCopyFileRange = 1 << 0,    // copy_file_range，同一文件系统下可能直接共享数据块
+        kSendFile = 1 << 1,         // sendfile，内核中拷贝
+        kSplice = 1 << 2,           // splice 经过管道，内核中拷贝
+        kBuffered = 1 << 3,         // 用户空间缓冲区 pread + pwrite
+        kAllStrategy = kCopyFileRange | kSendFile | kSplice | kBuffered,
+    };
+
+    struct Options
+    {
+        int strategy {kAllStrategy};    // 允许使用的拷贝方式
+        bool keep_sparse {true};        // 跳过源文件空洞，保持目标文件稀疏
+        unsigned thread_count {0};      // 并行拷贝线程数，0 表示按 CPU 核心数
+        size_t parallel_threshold {size_t(256) << 20};  // 超过该大小才进行并行拷贝
+        size_t buffer_size {size_t(1) << 20};           // 用户空间缓冲区和管道大小
+        Crc32c* checksum {nullptr};     // 不为空时在拷贝的同时计算源文件的 CRC32C，空洞按 0 计算
+                                        // 数据需要经过用户空间，只使用 pread + pwrite，但只读取一次
+        bool detect_zeros {false};      // 数据中全为 0 的块不写入，在目标文件中留下空洞，只使用 pread + pwrite
+    };
+
+    // 一段需要拷贝的数据
+    typedef File::Extent Range;
+
+public:
+    FileCopier() = default;
+    explicit FileCopier(const Options& _options)
+        : _options(_options)
+    {}
+
+    const Options& options() const {
+        return this->_options;
+    }
+
+    // 拷贝整个文件，目标文件会被截断为源文件大小，返回拷贝的字节数
+    // 源和目标是同一个文件时什么都不做，返回 0；拷贝失败时目标截断到第一个没有拷贝完整的位置
+    size_t copy(const File& _src, const File& _dst) const;
+    // 拷贝源文件 [_offset, _offset + _count) 到目标文件相同位置
+    size_t copyRange(int _in_fd, int _out_fd, off64_t _offset, size_t _count, bool _parallel = false) const;
+    // 获取源文件中含有数据的区域
+    static std::vector<Range> dataRanges(int _fd, off64_t _size, bool _keep_sparse);
+
+private:
+    size_t copyByCopyFileRange(int _in_fd, int _out_fd, off64_t _offset, size_t _count) const;
+    size_t copyBySendFile(int _in_fd, int _out_fd, off64_t _offset, size_t _count) const;
+    size_t copyBySplice(int _in_fd, int _out_fd, off64_t _offset, size_t _count) const;
+    size_t copyByBuffer(int _in_fd, int _out_fd, off64_t _offset, size_t _count, uint32_t* _crc = nullptr) const;
+
+private:
+    Options _options;
+
+}; // FileCopier
+
+#endif // __LINUX_STUDY_FILE_TOOL_FILE_COPY_H
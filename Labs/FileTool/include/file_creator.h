@@ -0,0 +1,72 @@
+/**
+* @File file_creator.h
+* @Date 2023-04-10
+* @Description 批量创建文件，记录已经创建的目录，相对目录描述符创建
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_FILE_CREATOR_H
+#define __LINUX_STUDY_FILE_TOOL_FILE_CREATOR_H
+
+#include "file_tool.h"
+#include <unordered_map>
+#include <unordered_set>
+
+class FileCreator
+{
+public:
+    struct Options
+    {
+        int file_mode {0644};           // 新建文件权限
+        int dir_mode {0777};            // 新建目录权限，受 umask 影响
+        int open_flags {File::kCreateForce | File::kTrunc | File::kWriteOnly};    // 打开文件的标志
+        size_t max_open_dirs {1024};    // 最多保持打开的目录数量
+        unsigned thread_count {1};      // createAll 使用的线程数，按路径开始分叉的那一级子目录划分
+    };
+
+public:
+    // 所有路径都相对于 _root，_root 不存在时会被创建
+    explicit FileCreator(std::string _root);
+    explicit FileCreator(std::string _root, const Options& _options);
+    ~FileCreator();
+
+    FileCreator(const FileCreator&) = delete;
+    FileCreator& operator = (const FileCreator&) = delete;
+
+    explicit operator bool() const {
+        return (this->_root_fd >= 0);
+    }
+
+    // 创建文件并立即关闭
+    bool create(const std::string& _path);
+    // 创建文件并返回打开的文件，返回的 File 去掉了创建和截断标志，复制时不会再次创建或截断
+    File open(const std::string& _path);
+    // 创建文件，返回文件描述符，需要调用者关闭
+    int openFd(const std::string& _path);
+    // 创建目录，返回缓存中的目录描述符，不能由调用者关闭
+    int makeDir(const std::string& _dir);
+    // 批量创建文件，返回成功数量
+    size_t createAll(const std::vector<std::string>& _paths);
+
+    const std::string& root() const {
+        return this->_root;
+    }
+    // 清空目录缓存，关闭所有目录描述符
+    void clearCache();
+
+private:
+    // 获取目录描述符，不存在时逐级创建
+    int dirFd(const std::string& _dir);
+
+private:
+    Options _options;
+    std::string _root;
+    int _root_fd {-1};
+    std::unordered_map<std::string, int> _dir_fds;  // 已经打开的目录
+    std::unordered_set<std::string> _known_dirs;    // 已知存在的目录
+
+}; // FileCreator
+
+#endif // __LINUX_STUDY_FILE_TOOL_FILE_CREATOR_H
@@ -0,0 +1,98 @@
+/**
+* @File file_follow.h
+* @Date 2023-04-13
+* @Description 使用 inotify 跟踪持续增长的文件，类似 tail -F
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_FILE_FOLLOW_H
+#define __LINUX_STUDY_FILE_TOOL_FILE_FOLLOW_H
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+class FollowReader
+{
+public:
+    // 一批完整的行，不包含换行符，返回 false 停止跟踪
+    typedef std::function<bool(const std::vector<std::string>&)> Callback;
+
+    struct Options
+    {
+        bool from_start {false};        // 从文件开头读取，否则只读取开始跟踪后追加的内容
+        bool follow_roll {true};        // 出现 RollLogFile 的下一个分段时切换过去
+        size_t buffer_size {size_t(64) << 10};  // 每次读取的大小
+        size_t max_batch {1024};        // 每批最多投递的行数
+    };
+
+public:
+    explicit FollowReader(std::string _path)
+        : FollowReader(std::move(_path), Options())
+    {}
+    FollowReader(std::string _path, const Options& _options);
+    ~FollowReader();
+
+    FollowReader(const FollowReader&) = delete;
+    FollowReader& operator = (const FollowReader&) = delete;
+
+    // 阻塞跟踪文件，直到回调返回 false、调用 stop 或者出错，出错时返回 false
+    // 等待时不占用 CPU，文件写入后立即被唤醒
+    bool follow(const Callback& _callback);
+    // 可以在其他线程中调用
+    void stop();
+
+    // 当前正在读取的文件
+    const std::string& path() const {
+        return this->_path;
+    }
+    const char* errorMsg() const {
+        return std::strerror(this->_error);
+    }
+
+    // RollLogFile 的下一个分段，文件名为 base_name + 序号 + ".log"，app1.log -> app2.log
+    // 文件名以序号结尾时递增该序号，app.log1 -> app.log2，找不到序号时返回空
+    static std::string nextSegment(const std::string& _path);
+
+private:
+    bool openFile(bool _seek_end);
+    void closeFile();
+    // 处理 inotify 事件，返回 false 表示结束跟踪
+    bool handleEvents();
+    // 读取新追加的内容并投递，返回 false 表示结束跟踪
+    bool readNew();
+    // 切换到新的文件，当前文件中剩余的不完整行作为最后一行投递
+    bool switchTo(const std::string& _path);
+    // 下一个分段已经存在时直接切换
+    bool checkRoll();
+    // 路径已经指向另一个文件，inotify 队列溢出丢失事件时检查
+    bool replaced() const;
+    bool pushLine(const char* _data, size_t _size);
+    bool deliver();
+
+private:
+    std::string _path;
+    std::string _dir;
+    Options _options;
+    int _fd {-1};
+    int _inotify_fd {-1};
+    int _event_fd {-1};
+    int _file_wd {-1};
+    int _dir_wd {-1};
+    int _error {0};
+    std::atomic<bool> _stopped {false};    // stop 可能在其他线程中写入
+    off64_t _offset {0};
+    std::string _partial;               // 最后一个不完整的行
+    std::vector<char> _buf;
+    std::vector<std::string> _lines;    // 等待投递的行
+    const Callback* _callback {nullptr};
+
+}; // FollowReader
+
+#endif // __LINUX_STUDY_FILE_TOOL_FILE_FOLLOW_H
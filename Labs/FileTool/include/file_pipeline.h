@@ -0,0 +1,74 @@
+/**
+* @File file_pipeline.h
+* @Date 2023-04-18
+* @Description 读取、转换、写入三个阶段并行的流水线，转换可以在多个线程中进行，输出保持原有顺序
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_FILE_PIPELINE_H
+#define __LINUX_STUDY_FILE_TOOL_FILE_PIPELINE_H
+
+#include "file_tool.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class FilePipeline
+{
+public:
+    // 流水线中的一块数据，缓冲区在块之间循环使用，稳定后不再分配内存
+    struct Chunk
+    {
+        size_t index;           // 块序号，输出按序号顺序写入
+        off64_t offset;         // 在输入文件中的位置
+        std::vector<File::byte> input;      // 容量为块大小，有效数据为前 size 字节
+        size_t size;
+        std::vector<File::byte> output;     // 转换结果，调用转换前会被清空，容量保留
+
+        const File::byte* data() const {
+            return this->input.data();
+        }
+    };
+
+    // 转换一块数据，结果写入 _chunk.output，返回 false 时停止整个流水线
+    typedef std::function<bool(Chunk& _chunk)> Transform;
+
+    struct Options
+    {
+        size_t chunk_size {size_t(1) << 20};    // 每块读取的大小
+        unsigned worker_count {0};      // 转换线程数，0 表示按 CPU 核心数
+        size_t queue_depth {0};         // 同时在流水线中的块数量，0 表示转换线程数的两倍再加 2
+        bool line_aligned {false};      // 块在换行符之后结束，转换只会看到完整的行
+    };
+
+    struct Stats
+    {
+        size_t chunk_count {0};
+        uint64_t read_bytes {0};
+        uint64_t written_bytes {0};
+    };
+
+public:
+    FilePipeline() = default;
+    explicit FilePipeline(const Options& _options)
+        : _options(_options)
+    {}
+
+    // 从 _reader 当前位置读到文件尾，转换后写入 _writer
+    bool run(FileReader& _reader, FileWriter& _writer, const Transform& _transform);
+    // 输出文件会被创建或截断，和输入是同一个文件时不做任何修改，返回 false
+    bool run(const std::string& _input, const std::string& _output, const Transform& _transform);
+
+    const Stats& stats() const {
+        return this->_stats;
+    }
+
+private:
+    Options _options;
+    Stats _stats;
+
+}; // FilePipeline
+
+#endif // __LINUX_STUDY_FILE_TOOL_FILE_PIPELINE_H
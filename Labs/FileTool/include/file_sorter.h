@@ -0,0 +1,103 @@
+/**
+* @File file_sorter.h
+* @Date 2023-04-15
+* @Description 外部归并排序，按内存预算生成有序的临时文件，再用败者树多路归并
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_FILE_SORTER_H
+#define __LINUX_STUDY_FILE_TOOL_FILE_SORTER_H
+
+#include "file_tool.h"
+#include "line_mapper.h"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+class FileSorter
+{
+public:
+    // 从一行或一条记录中取出用于比较的部分，返回的视图必须在原数据内
+    typedef std::function<LineView(const LineView&)> KeyExtractor;
+    // 比较两个键，为空时按字节序比较
+    typedef std::function<bool(const LineView&, const LineView&)> KeyLess;
+
+    struct Options
+    {
+        size_t memory_budget {size_t(256) << 20};   // 生成有序段时使用的内存，分为两块交替读取和排序
+        unsigned thread_count {0};      // 排序线程数，0 表示按 CPU 核心数
+        size_t record_size {0};         // 定长记录大小，0 表示按行排序，输出的每一行都以换行符结尾
+        size_t buffer_size {size_t(1) << 20};   // 归并时每个输入和输出的缓冲区大小
+        std::string temp_dir {"/tmp"};  // 临时文件目录
+        KeyExtractor key;               // 为空时使用整行或整条记录
+        KeyLess less;
+    };
+
+public:
+    FileSorter() = default;
+    explicit FileSorter(const Options& _options)
+        : _options(_options)
+    {}
+
+    FileSorter(const FileSorter&) = delete;
+    FileSorter& operator = (const FileSorter&) = delete;
+
+    // 排序 _input 写入 _output，排序是稳定的，失败时返回 false
+    // _output 和 _input 是同一个文件（包括硬链接）时不做任何修改，返回 false，错误为 EINVAL
+    bool sort(const std::string& _input, const std::string& _output);
+
+    // 上一次排序生成的有序段数量
+    size_t runCount() const {
+        return this->_run_count;
+    }
+    const char* errorMsg() const {
+        return std::strerror(this->_error);
+    }
+
+private:
+    // 排序中的一行或一条记录，键已经提前取出
+    struct Item
+    {
+        const char* data;
+        size_t size;
+        const char* key;
+        size_t key_size;
+    };
+
+    // 一块读入内存的数据
+    struct Chunk
+    {
+        std::vector<char> data;
+        size_t size {0};
+        std::vector<Item> items;
+    };
+
+private:
+    // 读取一块数据，返回 false 表示已经没有数据
+    // 按行排序时一块最多 _max_items 行
+    bool readChunk(FileReader& _reader, Chunk& _chunk, std::string& _carry, size_t _capacity, size_t _max_items);
+    void parseChunk(Chunk& _chunk) const;
+    void sortChunk(Chunk& _chunk) const;
+    bool writeChunk(const Chunk& _chunk, FileWriter& _writer) const;
+    // 排序并写入临时文件
+    bool spillChunk(Chunk& _chunk, const std::string& _path);
+    // 有序段超过一次能打开的数量时，分组归并成新的有序段，直到可以一次归并完
+    void reduceRuns(std::vector<std::string>& _runs);
+    bool mergeRuns(const std::vector<std::string>& _runs, FileWriter& _writer);
+
+    bool itemLess(const Item& _a, const Item& _b) const;
+    bool keyLess(const char* _a, size_t _a_size, const char* _b, size_t _b_size) const;
+    Item makeItem(const char* _data, size_t _size) const;
+    unsigned threadCount() const;
+
+private:
+    Options _options;
+    size_t _run_count {0};
+    std::atomic<int> _error {0};
+
+}; // FileSorter
+
+#endif // __LINUX_STUDY_FILE_TOOL_FILE_SORTER_H
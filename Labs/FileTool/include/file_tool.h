@@ -14,10 +14,155 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <dirent.h>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <cstring>
 #include <vector>
+#include <type_traits>
+
+class Crc32c;
+class Arena;
+
+// 字节序
+enum class Endian : int {
+    kNative = 0,    // 不转换
+    kLittle,        // 小端
+    kBig,           // 大端
+};
+
+// 判断是否需要转换为 _endian 字节序
+inline bool needSwapBytes(Endian _endian)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return _endian == Endian::kBig;
+#else
+    return _endian == Endian::kLittle;
+#endif
+}
+
+// 原地批量转换字节序，_elem_size 为 2、4、8 时有效，支持时使用 SSSE3 指令
+void swapBytes(void* _data, size_t _elem_size, size_t _count);
+
+// 判断一块内存是否全为 0，支持时使用 AVX2 指令
+bool isAllZero(const void* _data, size_t _size);
+
+// 文件信息快照，一次 statx 只获取需要的字段
+class FileStat
+{
+public:
+    enum : unsigned {
+        kType = STATX_TYPE,     // 文件类型
+        kMode = STATX_MODE,     // 权限
+        kOwner = STATX_UID | STATX_GID,     // 所有者
+        kSize = STATX_SIZE,     // 文件大小
+        kBlocks = STATX_BLOCKS, // 占用的块数
+        kInode = STATX_INO | STATX_NLINK,   // inode 编号与链接数
+        kTime = STATX_ATIME | STATX_MTIME | STATX_CTIME,    // 访问、修改、状态改变时间
+        kDefault = kType | kMode | kOwner | kSize,  // File 访问器默认获取的字段
+        kAll = STATX_BASIC_STATS,
+    };
+
+    FileStat() = default;
+
+    // 获取 _dir_fd 目录下 _path 的信息，_flags 可以为 AT_SYMLINK_NOFOLLOW、AT_EMPTY_PATH 等
+    static FileStat of(int _dir_fd, const char* _path, unsigned _mask = kDefault, int _flags = 0);
+    static FileStat of(const char* _path, unsigned _mask = kDefault, int _flags = 0) {
+        return FileStat::of(AT_FDCWD, _path, _mask, _flags);
+    }
+    // 获取打开文件的信息
+    static FileStat of(int _fd, unsigned _mask = kDefault) {
+        return FileStat::of(_fd, "", _mask, AT_EMPTY_PATH);
+    }
+    // 批量获取同一目录下多个文件的信息，每个文件只相对目录查找一次
+    static std::vector<FileStat> batch(int _dir_fd, const std::vector<std::string>& _names,
+                                       unsigned _mask = kDefault, int _flags = 0);
+
+    explicit operator bool() const {
+        return (this->_error == 0);
+    }
+    int error() const {
+        return this->_error;
+    }
+    // 是否获取到了指定字段
+    bool has(unsigned _mask) const {
+        return (this->_mask & _mask) == _mask;
+    }
+
+    mode_t mode() const {
+        return this->_mode;
+    }
+    off64_t size() const {
+        return this->_size;
+    }
+    uid_t uid() const {
+        return this->_uid;
+    }
+    gid_t gid() const {
+        return this->_gid;
+    }
+    ino64_t ino() const {
+        return this->_ino;
+    }
+    nlink_t nlink() const {
+        return this->_nlink;
+    }
+    blkcnt64_t blocks() const {
+        return this->_blocks;
+    }
+    blksize_t blockSize() const {
+        return this->_block_size;
+    }
+    const struct timespec& accessTime() const {
+        return this->_atime;
+    }
+    const struct timespec& modifyTime() const {
+        return this->_mtime;
+    }
+    const struct timespec& changeTime() const {
+        return this->_ctime;
+    }
+
+    bool isRegularFile() const {
+        return S_ISREG(this->_mode);
+    }
+    bool isDirectory() const {
+        return S_ISDIR(this->_mode);
+    }
+    bool isCharFile() const {
+        return S_ISCHR(this->_mode);
+    }
+    bool isBlockFile() const {
+        return S_ISBLK(this->_mode);
+    }
+    bool isFiFoFile() const {
+        return S_ISFIFO(this->_mode);
+    }
+    bool isLinkFile() const {
+        return S_ISLNK(this->_mode);
+    }
+    bool isSocket() const {
+        return S_ISSOCK(this->_mode);
+    }
+
+private:
+    unsigned _mask {0};         // 获取到的字段
+    int _error {0};             // 获取失败时的错误
+    mode_t _mode {0};
+    uid_t _uid {0};
+    gid_t _gid {0};
+    nlink_t _nlink {0};
+    ino64_t _ino {0};
+    off64_t _size {0};
+    blkcnt64_t _blocks {0};
+    blksize_t _block_size {0};
+    struct timespec _atime {};
+    struct timespec _mtime {};
+    struct timespec _ctime {};
+
+}; // FileStat
 
 class File
 {
@@ -28,6 +173,24 @@ public:
 
     friend class FileReader;
     friend class FileWriter;
+    friend class FileCopier;
+    friend class FileCreator;
+    friend class MappedFile;
+    friend class RecordFileWriter;
+    friend class FileSorter;
+    friend class FileChunker;
+    friend class FileCache;
+    friend class FilePipeline;
+    friend class DirectIO;
+
+    // 文件中连续的一段数据或空洞
+    struct Extent
+    {
+        off64_t offset;
+        size_t length;
+        bool hole;
+    };
+
     enum : int{
         kCreateForce = O_CREAT, // 强制创建
         kCreateNotExist = O_CREAT | O_EXCL, // 不存在则创建
@@ -38,6 +201,7 @@ public:
         kAppend = O_APPEND,     // 打开时移动到文件尾
         kNotLink = O_NOFOLLOW,  // 不能为链接文件
         kRequireDir = O_DIRECTORY,   // 要求打开文件为目录
+        kDirect = O_DIRECT,     // 绕过页缓存，文件系统不支持时自动退回普通模式，读写见 DirectIO
         kUserRead = S_IRUSR,
         kUserWrite = S_IWUSR,
         kUserExec = S_IXUSR,
@@ -53,12 +217,18 @@ private:
     static const int kDefaultOpenFlags = (kReadWrite);
     static const int kMaxRetryCount = 3;
 
+public:
+    // O_DIRECT 读写时内存地址、文件偏移和长度的对齐要求，覆盖常见的逻辑块大小
+    static const size_t kDirectAlign = 4096;
+
 public:
     // 创建文件
     static File create(const std::string& _path, int _file_mode, bool _is_recursion = false, int _dir_mode = 0);
     static File createIfNotExist(const std::string& _path, int _file_mode, bool _is_recursion = false, int _dir_mode = 0);
-    // 打开文件
-    static File open(const std::string& _path, int _flags = 0);
+    // 打开文件，没有指定 kWriteOnly 或 kReadWrite 时只读打开
+    static File open(const std::string& _path, int _flags = kReadOnly);
+    // 递归创建目录
+    static bool createDirs(const std::string& _dir, int _dir_mode = 0);
 
     // 判断文件或目录是否存在
     static bool isExist(const char* _path) {
@@ -71,33 +241,27 @@ public:
         stat64(_name, &s);
         return s;
     }
+    // 判断文件类型，每次只获取文件类型一个字段
     static bool isRegularFile(const char* _name)  {
-        auto file_info = File::fileInfo(_name);
-        return S_ISREG(file_info.st_mode);
+        return FileStat::of(_name, FileStat::kType).isRegularFile();
     }
     static bool isDirectoryFile(const char* _name)  {
-        auto file_info = File::fileInfo(_name);
-        return S_ISDIR(file_info.st_mode);
+        return FileStat::of(_name, FileStat::kType).isDirectory();
     }
     static bool isCharFile(const char* _name)  {
-        auto file_info = File::fileInfo(_name);
-        return S_ISCHR(file_info.st_mode);
+        return FileStat::of(_name, FileStat::kType).isCharFile();
     }
     static bool isBlockFile(const char* _name)  {
-        auto file_info = File::fileInfo(_name);
-        return S_ISBLK(file_info.st_mode);
+        return FileStat::of(_name, FileStat::kType).isBlockFile();
     }
     static bool isFiFoFile(const char* _name)  {
-        auto file_info = File::fileInfo(_name);
-        return S_ISFIFO(file_info.st_mode);
+        return FileStat::of(_name, FileStat::kType).isFiFoFile();
     }
     static bool isLinkFile(const char* _name)  {
-        auto file_info = File::fileInfo(_name);
-        return S_ISLNK(file_info.st_mode);
+        return FileStat::of(_name, FileStat::kType, AT_SYMLINK_NOFOLLOW).isLinkFile();
     }
     static bool isSocketFile(const char* _name)  {
-        auto file_info = File::fileInfo(_name);
-        return S_ISSOCK(file_info.st_mode);
+        return FileStat::of(_name, FileStat::kType).isSocket();
     }
 
 protected:
@@ -125,6 +289,13 @@ protected:
     {
         this->_open(_flags, _mode);
     }
+    // 接管已经打开的文件描述符
+    explicit File(int _fd, std::string _name, int _flags)
+        : _open_flags(_flags)
+        , _fd(_fd)
+        , _error(_fd < 0 ? errno : 0)
+        , _file_name(std::move(_name))
+    {}
     File(const File& _file)
         : _file_name(_file._file_name)
         , _open_flags(_file._open_flags)
@@ -139,9 +310,40 @@ protected:
         if (this->_fd >= 0) {
             ::close(this->_fd);
         }
+        // 按源文件的标志重新打开，打开失败时不能留下已经关闭的描述符
+        this->_fd = -1;
         this->_file_name = _file._file_name;
         this->_error = 0;
-        this->_open(this->_open_flags, -1);
+        this->_stat_mask = 0;
+        this->_open(_file._open_flags, -1);
+        return *this;
+    }
+    // 移动时直接转移文件描述符，不需要重新打开文件
+    File(File&& _file) noexcept
+        : _open_flags(_file._open_flags)
+        , _fd(_file._fd)
+        , _error(_file._error)
+        , _file_name(std::move(_file._file_name))
+        , _stat(_file._stat)
+        , _stat_mask(_file._stat_mask.load())
+    {
+        _file._fd = -1;
+    }
+    File& operator = (File&& _file) noexcept
+    {
+        if (this == &_file) {
+            return *this;
+        }
+        if (this->_fd >= 0) {
+            ::close(this->_fd);
+        }
+        this->_open_flags = _file._open_flags;
+        this->_fd = _file._fd;
+        this->_error = _file._error;
+        this->_file_name = std::move(_file._file_name);
+        this->_stat = _file._stat;
+        this->_stat_mask = _file._stat_mask.load();
+        _file._fd = -1;
         return *this;
     }
 
@@ -150,44 +352,63 @@ protected:
     }
 
 public:
+    // 析构时不再调用 fsync，需要持久化时显式调用 flush 或者使用 FileWriter 的同步模式
     ~File() {
-        this->flush();
         if (this->_fd >= 0) {
             ::close(this->_fd);
         }
     }
 
+    // 以下访问器使用缓存的文件信息，通过本对象写入、截断时缓存自动失效
+    // 文件被其他进程或者其他描述符修改后缓存不会更新，size() 可能是旧值，需要调用 refreshStat
     off_t size() const {
-        return this->getFileInfo().st_size;
+        return this->stat(FileStat::kSize).size();
     }
     uid_t ownerUid() const {
-        return this->getFileInfo().st_uid;
+        return this->stat(FileStat::kOwner).uid();
     }
     gid_t ownerGid() const {
-        return this->getFileInfo().st_gid;
+        return this->stat(FileStat::kOwner).gid();
     }
 
+    // 是否以 O_DIRECT 打开，文件系统不支持时为 false
+    bool isDirect() const {
+        return (this->_open_flags & O_DIRECT) != 0;
+    }
+    // 是否和 _other 是同一个文件，按设备和 inode 比较，硬链接和不同路径也能识别
+    bool sameFile(const File& _other) const;
+
     // 判断文件类型
     bool isRegularFile() const {
-        return S_ISREG(this->getFileInfo().st_mode);
+        return this->stat(FileStat::kType).isRegularFile();
     }
     bool isDirectory() const {
-        return S_ISDIR(this->getFileInfo().st_mode);
+        return this->stat(FileStat::kType).isDirectory();
     }
     bool isCharFile() const {
-        return S_ISCHR(this->getFileInfo().st_mode);
+        return this->stat(FileStat::kType).isCharFile();
     }
     bool isBlockFile() const {
-        return S_ISBLK(this->getFileInfo().st_mode);
+        return this->stat(FileStat::kType).isBlockFile();
     }
     bool isFiFoFile() const {
-        return S_ISBLK(this->getFileInfo().st_mode);
+        return this->stat(FileStat::kType).isFiFoFile();
     }
     bool isLinkFile() const {
-        return S_ISLNK(this->getFileInfo().st_mode);
+        return this->stat(FileStat::kType).isLinkFile();
     }
     bool isSocket() const {
-        return S_ISSOCK(this->getFileInfo().st_mode);
+        return this->stat(FileStat::kType).isSocket();
+    }
+
+    // 获取缓存的文件信息，缓存中没有需要的字段时才会调用 statx
+    // 返回副本，可以在多个线程中和读写同时调用
+    FileStat stat(unsigned _mask = FileStat::kDefault) const;
+    // 重新获取文件信息
+    FileStat refreshStat(unsigned _mask = FileStat::kDefault) const;
+    // 丢弃缓存，下次访问时重新获取，不加锁，positional 读写中也可以调用
+    void invalidateStat() const {
+        this->_stat_mask.store(kStatStale);
     }
 
     // 返回当前错误信息
@@ -196,20 +417,48 @@ public:
         return std::strerror(_error);
     }
 
-    // 刷新缓存
+    // 刷新缓存，数据和元数据全部写入磁盘
     void flush() const {
         if (this->_fd >= 0) {
             ::fsync(this->_fd);
         }
     }
+    // 只将数据写入磁盘，不等待无关的元数据
+    void flushData() const {
+        if (this->_fd >= 0) {
+            ::fdatasync(this->_fd);
+        }
+    }
 
 public:
     size_t readBytes(bytePtr _buf, size_t _count) const;
     size_t writeBytes(constBytePtr _content, size_t _count) const;
-    // 读取任意一块内容
+    // 读取任意一块内容，不改变文件偏移
     size_t multiReadBytes(bytePtr _buf, size_t _start, size_t _count) const;
     // 写入任意一块
     size_t multiWriteBytes(constBytePtr _content, size_t _start, size_t _count) const;
+    // 分散读取和集中写入，一次系统调用处理多块内存，部分传输时从中断处继续，返回传输的总字节数
+    size_t readVector(const struct iovec* _iov, int _count) const;
+    size_t writeVector(const struct iovec* _iov, int _count) const;
+    // 在指定位置分散读取和集中写入，不改变文件偏移
+    size_t multiReadVector(const struct iovec* _iov, int _count, size_t _start) const;
+    size_t multiWriteVector(const struct iovec* _iov, int _count, size_t _start) const;
+    // 拷贝全部内容到目标文件，尽量在内核中完成，详细选项见 FileCopier
+    size_t copyTo(const File& _dst) const;
+    size_t copyTo(const std::string& _path, int _file_mode) const;
+
+    // 使用 SEEK_DATA/SEEK_HOLE 获取 [_start, _end) 中的数据和空洞，_end 小于 0 时到文件尾
+    // 文件系统不支持时整个范围都当作数据，不改变文件偏移
+    std::vector<Extent> extents(off64_t _start = 0, off64_t _end = -1) const;
+    // 只获取数据部分
+    std::vector<Extent> dataExtents(off64_t _start = 0, off64_t _end = -1) const;
+    // 释放 [_offset, _offset + _count) 占用的磁盘空间，文件大小不变，之后读取为 0
+    bool punchHole(off64_t _offset, size_t _count) const;
+    // 找出内容全为 0 的块并打洞，_block_size 为 0 时使用文件系统块大小，返回释放的字节数
+    size_t sparsify(size_t _block_size = 0) const;
+
+private:
+    static std::vector<Extent> seekExtents(int _fd, off64_t _start, off64_t _end, bool _with_holes);
 
 public:
     // 初始化文件属性信息
@@ -223,20 +472,42 @@ public:
     bool _open(int _flags, int _mode);
 
 private:
+    // 调用时已经持有 _stat_lock
+    void refreshStatLocked(unsigned _mask) const;
+    // 缓存被丢弃的标记，不和 statx 字段重叠，重新获取期间被丢弃时获取结果不再标记为有效
+    static const unsigned kStatStale = 1u << 31;
+
     int _open_flags;    // 文件打开标志
     int _fd {-1};       // 打开文件描述符
     int _error {0};     // 当前错误
     std::string _file_name;     // 文件名称
+    mutable FileStat _stat;     // 缓存的文件信息，由 _stat_lock 保护
+    mutable std::atomic<unsigned> _stat_mask {0};   // 缓存中有效的字段
+    mutable std::mutex _stat_lock;
 
 }; // File
 
+// 文件中的一行，不包含换行符，有效期由提供数据的一方决定
+struct LineView
+{
+    const char* data;
+    size_t size;
+
+    std::string str() const {
+        return std::string(this->data, this->size);
+    }
+    bool empty() const {
+        return this->size == 0;
+    }
+
+}; // LineView
 
 // 读取文件
 class FileReader
 {
 public:
     explicit FileReader(File&& file) noexcept
-        : _file(file)
+        : _file(std::move(file))
     {}
     ~FileReader() = default;
 
@@ -247,22 +518,78 @@ public:
     auto readStringLine() const -> std::string;
     auto readVecLine() const -> std::vector<unsigned char>;
     auto readString(size_t _len) const -> std::string;
+    // 从当前位置读取 _len 字节，_len 不小于 1 MiB 时空洞部分直接填 0，不产生磁盘读取
+    // 不带长度的 readString 和 readVec 读取到重新获取的文件大小为止
     auto readVec(size_t _len) const -> std::vector<unsigned char>;
 
+    // 以下读取到调用者提供的内存中，容器的容量重复利用，循环读取时不再分配内存
+    // 读取最多 _count 字节到 _buf，返回读取的字节数
+    size_t read(void* _buf, size_t _count) const;
+    // 读取最多 _len 字节，替换 _content 原有内容，返回读取的字节数
+    size_t readString(std::string& _content, size_t _len) const;
+    size_t readVec(std::vector<File::byte>& _content, size_t _len) const;
+    // 读取一行到 _line，不包含换行符，已经到文件尾时返回 false
+    bool readLine(std::string& _line) const;
+    bool readLine(std::vector<File::byte>& _line) const;
+    // 行的内容分配在 _arena 中，_arena 重置之前一直有效
+    bool readLine(Arena& _arena, LineView& _line) const;
+
 
     template<typename Tp, typename Rt = typename std::remove_cv<Tp>::type>
     auto readTo() const -> Rt*;
 
+    // 批量读取 _count 条定长记录到调用者提供的内存，返回读取的完整记录数
+    template<typename Tp>
+    size_t readRecords(Tp* _records, size_t _count) const;
+    // 读取并从 _endian 字节序转换为本机字节序，记录只能是算术类型
+    template<typename Tp>
+    size_t readRecords(Tp* _records, size_t _count, Endian _endian) const;
+    // 读取到 vector 中，vector 的容量可以重复利用
+    template<typename Tp>
+    size_t readRecords(std::vector<Tp>& _records, size_t _count) const;
+
+    // 流式读取：在读取位置之后预读 _ahead 字节，并丢弃读取位置之前超过 _behind 字节的页缓存
+    // 适合只读取一遍的大文件，避免挤占其他程序的页缓存，_ahead 为 0 时关闭
+    void setStreaming(size_t _ahead = kDefaultStreamWindow, size_t _behind = kDefaultStreamWindow);
+
     explicit operator bool() const {
         return bool(this->_file);
     }
 
+    // 读取行时多读的内容会先退回文件中，保证文件偏移就是读取位置
     File& file() {
+        this->unbuffer();
         return this->_file;
     }
 
+public:
+    static const size_t kDefaultStreamWindow = size_t(8) << 20;
+    static const size_t kLineBufferSize = 64 * 1024;
+
+private:
+    // 所有读取都经过这里，先取出读取行时多读的内容，流式读取时按读取量调整页缓存
+    size_t readBytes(File::bytePtr _buf, size_t _count) const;
+    // 读取行时一次读入一整块，返回 false 表示文件尾
+    bool fillLineBuffer() const;
+    template<typename Container>
+    bool readLineTo(Container& _line) const;
+    // 将缓冲区中未读取的内容退回文件中
+    void unbuffer() const;
+    void advanceStream(size_t _count) const;
+    // 读取 _count 个 _record_size 大小的记录，末尾不完整的记录退回文件中
+    size_t readRecordBytes(void* _records, size_t _record_size, size_t _count) const;
+    void adviseStream() const;
+
 private:
     File _file;
+    size_t _stream_ahead {0};           // 预读窗口
+    size_t _stream_behind {0};          // 保留已读取内容的大小
+    mutable size_t _stream_pending {0}; // 上次调整后读取的字节数
+    mutable off64_t _stream_dropped {0};    // 已经丢弃页缓存的位置
+    mutable std::vector<File::byte> _line_buf;  // 第一次读取行时分配
+    mutable size_t _line_pos {0};       // 缓冲区中 [_line_pos, _line_end) 还未被读取
+    mutable size_t _line_end {0};
+    mutable std::string _line_scratch;  // 跨越缓冲区的行先拼接在这里
 
 }; // FileReader
 
@@ -270,36 +597,167 @@ template<typename Tp, typename Rt>
 auto FileReader::readTo() const -> Rt*
 {
     Rt* tp = new Rt;
-    this->_file.readBytes((File::bytePtr)((void*)tp), sizeof(Rt));
+    this->readBytes((File::bytePtr)((void*)tp), sizeof(Rt));
     return tp;
 }
 
+template<typename Tp>
+size_t FileReader::readRecords(Tp* _records, size_t _count) const
+{
+    static_assert(std::is_trivially_copyable<Tp>::value, "record must be trivially copyable");
+    return this->readRecordBytes((void*)_records, sizeof(Tp), _count);
+}
+
+template<typename Tp>
+size_t FileReader::readRecords(Tp* _records, size_t _count, Endian _endian) const
+{
+    static_assert(std::is_arithmetic<Tp>::value, "only arithmetic records can be byte swapped");
+    size_t count = this->readRecords(_records, _count);
+    if (sizeof(Tp) > 1 && needSwapBytes(_endian)) {
+        swapBytes((void*)_records, sizeof(Tp), count);
+    }
+    return count;
+}
+
+template<typename Tp>
+size_t FileReader::readRecords(std::vector<Tp>& _records, size_t _count) const
+{
+    _records.resize(_count);
+    size_t count = this->readRecords(_records.data(), _count);
+    _records.resize(count);
+    return count;
+}
+
 class FileWriter
 {
 public:
-    explicit FileWriter(File&& file) noexcept
-        : _file(file)
+    // 写入器析构或者调用 sync 时的持久化方式
+    enum SyncMode : int {
+        kSyncNone = 0,  // 只写入内核，由系统决定何时落盘
+        kSyncData,      // fdatasync
+        kSyncFull,      // fsync
+    };
+    static const size_t kDefaultBufSize = 64 * 1024;
+    static const size_t kDefaultStreamWindow = size_t(8) << 20;
+
+    explicit FileWriter(File&& file, size_t _buffer_size = kDefaultBufSize, SyncMode _mode = kSyncNone) noexcept
+        : _file(std::move(file))
+        , _buf_size(_buffer_size)
+        , _sync_mode(_mode)
     {}
-    ~FileWriter() = default;
+    FileWriter(FileWriter&&) noexcept = default;
+    ~FileWriter() {
+        this->sync();
+    }
 
 public:
     size_t write(const std::string& _content);
     size_t write(const std::string& _content, size_t _count);
     size_t write(const std::vector<File::byte>& _content);
     size_t write(const std::vector<File::byte>& _content, size_t _count);
+    // 写入一块内存，小块写入会先放入缓冲区
+    size_t write(const void* _content, size_t _count);
+    // 按顺序写入多块内存，放不进缓冲区时和缓冲区内容一起用一次 writev 写出，返回写入的字节数
+    size_t write(const struct iovec* _iov, int _count);
+    size_t write(const std::vector<struct iovec>& _iov) {
+        return this->write(_iov.data(), int(_iov.size()));
+    }
 
     template<typename T, typename Tp = typename std::remove_cv<T>::type>
     size_t writeWith(const Tp& v);
 
+    // 批量写入定长记录，返回写入的完整记录数
+    template<typename Tp>
+    size_t writeRecords(const Tp* _records, size_t _count);
+    // 转换为 _endian 字节序后写入，不修改调用者的数据，记录只能是算术类型
+    template<typename Tp>
+    size_t writeRecords(const Tp* _records, size_t _count, Endian _endian);
+    template<typename Tp>
+    size_t writeRecords(const std::vector<Tp>& _records) {
+        return this->writeRecords(_records.data(), _records.size());
+    }
+
+    // 流式写入：每写入 _window 字节发起异步回写，等待上一个窗口落盘后丢弃其页缓存
+    // 写入速度受磁盘限制，但不会积累大量脏页，_window 为 0 时关闭
+    void setStreaming(size_t _window = kDefaultStreamWindow);
+
+    // 写入的同时计算 CRC32C，数据不需要再读取一次，传入 nullptr 取消
+    void setChecksum(Crc32c* _checksum) {
+        this->_checksum = _checksum;
+    }
+
+    // 将缓冲区内容写入文件，返回写入的字节数
+    size_t flush();
+    // flush 后按照构造时指定的方式持久化
+    void sync();
+
+    size_t bufferSize() const {
+        return this->_buf_size;
+    }
+    // 缓冲区中还未写入文件的字节数
+    size_t pending() const {
+        return this->_buf.size();
+    }
+    SyncMode syncMode() const {
+        return this->_sync_mode;
+    }
+
+    // 文件打开失败或者之前的写入出错时为 false
+    explicit operator bool() const {
+        return bool(this->_file) && this->_error == 0;
+    }
+    // 第一次写入失败时的错误，之后的写入都返回 0
+    int error() const {
+        return this->_error;
+    }
+
+    File& file() {
+        return this->_file;
+    }
+
+private:
+    // 分块转换字节序后写入
+    size_t writeSwapped(const void* _records, size_t _record_size, size_t _count);
+    // 直接写入文件，流式写入时按写入量回写
+    size_t writeBytes(File::constBytePtr _content, size_t _count);
+    void advanceStream(size_t _count);
+    // 根据 errno 记录写入错误
+    void setError();
+
 private:
     File _file;
+    size_t _buf_size;           // 缓冲区大小，为 0 时不使用缓冲区
+    SyncMode _sync_mode;        // 持久化方式
+    Crc32c* _checksum {nullptr};    // 写入内容的校验和
+    size_t _stream_window {0};      // 回写窗口
+    off64_t _stream_offset {0};     // 当前写入位置
+    off64_t _stream_start {-1};     // 当前窗口起始位置
+    std::vector<File::byte> _buf;   // 写入缓冲区
+    int _error {0};                 // 写入错误
 
 }; // FileWriter
 
 template<typename T, typename Tp>
 size_t FileWriter::writeWith(const Tp& v)
 {
-    return this->_file.writeBytes((File::constBytePtr)((void*)&v), sizeof(Tp));
+    return this->write((const void*)&v, sizeof(Tp));
+}
+
+template<typename Tp>
+size_t FileWriter::writeRecords(const Tp* _records, size_t _count)
+{
+    static_assert(std::is_trivially_copyable<Tp>::value, "record must be trivially copyable");
+    return this->write((const void*)_records, sizeof(Tp) * _count) / sizeof(Tp);
+}
+
+template<typename Tp>
+size_t FileWriter::writeRecords(const Tp* _records, size_t _count, Endian _endian)
+{
+    static_assert(std::is_arithmetic<Tp>::value, "only arithmetic records can be byte swapped");
+    if (sizeof(Tp) == 1 || !needSwapBytes(_endian)) {
+        return this->writeRecords(_records, _count);
+    }
+    return this->writeSwapped((const void*)_records, sizeof(Tp), _count);
 }
 
 
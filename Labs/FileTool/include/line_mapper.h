@@ -0,0 +1,104 @@
+/**
+* @File line_mapper.h
+* @Date 2023-04-14
+* @Description 按行并行处理大文件，每个线程处理一段按换行符对齐的区域，最后合并结果
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_LINE_MAPPER_H
+#define __LINUX_STUDY_FILE_TOOL_LINE_MAPPER_H
+
+#include "file_tool.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class LineMapper
+{
+public:
+    struct Options
+    {
+        unsigned thread_count {0};      // 工作线程数，0 表示按 CPU 核心数
+        bool use_mmap {true};           // 使用 mmap 读取，否则每个线程使用 pread 读入自己的缓冲区
+        size_t buffer_size {size_t(1) << 20};       // pread 缓冲区大小，超长的行会自动扩展
+        size_t min_range_size {size_t(4) << 20};    // 每段的最小大小，小文件不会被切得太碎
+    };
+
+    // 一段从行首开始、在换行符之后结束的区域
+    struct Range
+    {
+        off64_t offset;
+        size_t length;
+    };
+
+    // 处理一块完整的行，_index 为所在区域的序号
+    typedef std::function<void(size_t _index, const char* _data, size_t _size)> BlockCallback;
+
+public:
+    LineMapper() = default;
+    explicit LineMapper(const Options& _options)
+        : _options(_options)
+    {}
+
+    // 将文件切分为多个区域，区域数量为线程数的若干倍，方便线程间均衡
+    std::vector<Range> split(const File& _file) const;
+    // 多个线程按顺序领取区域，每个区域按块回调，块中只包含完整的行
+    bool forEachBlock(const File& _file, const std::vector<Range>& _ranges, const BlockCallback& _callback) const;
+
+    // 每个区域使用一个 Result，_map(Result&, const LineView&) 处理每一行
+    // 全部完成后按区域顺序调用 _reduce(Result& total, Result&& part) 合并，失败时返回 _init
+    template<typename Result, typename Map, typename Reduce>
+    Result mapReduce(const File& _file, const Result& _init, Map _map, Reduce _reduce) const;
+
+    // 将一块数据按行回调，最后一行可以没有换行符
+    template<typename Func>
+    static void forEachLine(const char* _data, size_t _size, Func&& _func);
+
+private:
+    unsigned threadCount() const;
+
+private:
+    Options _options;
+
+}; // LineMapper
+
+
+template<typename Func>
+void LineMapper::forEachLine(const char* _data, size_t _size, Func&& _func)
+{
+    const char* end = _data + _size;
+    while (_data < end) {
+        auto newline = (const char*)std::memchr(_data, '\n', size_t(end - _data));
+        if (newline == nullptr) {
+            _func(LineView{_data, size_t(end - _data)});
+            break;
+        }
+        _func(LineView{_data, size_t(newline - _data)});
+        _data = newline + 1;
+    }
+}
+
+template<typename Result, typename Map, typename Reduce>
+Result LineMapper::mapReduce(const File& _file, const Result& _init, Map _map, Reduce _reduce) const
+{
+    auto ranges = this->split(_file);
+    std::vector<Result> results(ranges.size(), _init);
+    bool ok = this->forEachBlock(_file, ranges, [&](size_t _index, const char* _data, size_t _size) {
+        Result& result = results[_index];
+        LineMapper::forEachLine(_data, _size, [&](const LineView& _line) {
+            _map(result, _line);
+        });
+    });
+    if (!ok || results.empty()) {
+        return _init;
+    }
+    Result total = std::move(results[0]);
+    for (size_t i = 1; i < results.size(); ++i) {
+        _reduce(total, std::move(results[i]));
+    }
+    return total;
+}
+
+#endif // __LINUX_STUDY_FILE_TOOL_LINE_MAPPER_H
@@ -0,0 +1,77 @@
+/**
+* @File mapped_file.h
+* @Date 2023-04-11
+* @Description 只读内存映射文件
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_MAPPED_FILE_H
+#define __LINUX_STUDY_FILE_TOOL_MAPPED_FILE_H
+
+#include "file_tool.h"
+#include <sys/mman.h>
+
+class MappedFile
+{
+public:
+    // 映射整个文件，映射完成后与 File 无关，可以在多个线程中同时读取
+    static MappedFile map(const File& _file);
+    static MappedFile map(const std::string& _path);
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+    MappedFile(MappedFile&& _file) noexcept
+        : _data(_file._data)
+        , _size(_file._size)
+        , _error(_file._error)
+    {
+        _file._data = nullptr;
+        _file._size = 0;
+    }
+    MappedFile& operator = (MappedFile&& _file) noexcept
+    {
+        if (this != &_file) {
+            this->unmap();
+            this->_data = _file._data;
+            this->_size = _file._size;
+            this->_error = _file._error;
+            _file._data = nullptr;
+            _file._size = 0;
+        }
+        return *this;
+    }
+    ~MappedFile() {
+        this->unmap();
+    }
+
+    explicit operator bool() const {
+        return (this->_error == 0);
+    }
+    const char* errorMsg() const {
+        return std::strerror(this->_error);
+    }
+
+    const File::byte* data() const {
+        return this->_data;
+    }
+    size_t size() const {
+        return this->_size;
+    }
+
+    // 提示内核访问方式，如 MADV_SEQUENTIAL、MADV_WILLNEED、MADV_DONTNEED
+    void advise(int _advice, size_t _start = 0, size_t _count = ~size_t(0)) const;
+
+private:
+    void unmap();
+
+private:
+    File::byte* _data {nullptr};
+    size_t _size {0};
+    int _error {0};
+
+}; // MappedFile
+
+#endif // __LINUX_STUDY_FILE_TOOL_MAPPED_FILE_H
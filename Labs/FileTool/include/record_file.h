@@ -0,0 +1,168 @@
+/**
+* @File record_file.h
+* @Date 2023-04-11
+* @Description 带索引和校验的记录文件，支持定长和变长记录，按记录编号 O(1) 随机访问
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_FILE_TOOL_RECORD_FILE_H
+#define __LINUX_STUDY_FILE_TOOL_RECORD_FILE_H
+
+#include "file_tool.h"
+#include "mapped_file.h"
+#include <cstdint>
+#include <functional>
+
+/*
+ * 文件布局：
+ *   [Header 64 字节]
+ *   [Block 0][Block 1]...      每块最多 records_per_block 条记录
+ *                              定长记录直接排列，变长记录为 [uint32 长度][数据]
+ *   [对齐到 8 字节]
+ *   [BlockIndex * block_count] 每块的偏移、大小和 CRC32C
+ *   [uint32 * record_count]    仅变长记录，每条记录在所在块内的偏移
+ */
+struct RecordFileHeader
+{
+    char magic[8];              // "LSRECORD"
+    uint32_t version;
+    uint32_t record_size;       // 定长记录大小，0 表示变长
+    uint32_t records_per_block;
+    uint32_t header_crc;        // 计算时该字段为 0
+    uint64_t record_count;
+    uint64_t block_count;
+    uint64_t index_offset;
+    uint32_t index_crc;         // 块索引和偏移表的校验和
+    uint32_t reserved[3];
+};
+
+struct RecordBlockIndex
+{
+    uint64_t offset;            // 块在文件中的偏移
+    uint32_t size;              // 块大小
+    uint32_t crc;               // 块数据的 CRC32C
+};
+
+// 记录内容，指向映射的内存，文件关闭后失效
+struct RecordView
+{
+    const File::byte* data;
+    size_t size;
+};
+
+class RecordFileWriter
+{
+public:
+    static const uint32_t kVersion = 1;
+    static const uint32_t kDefaultRecordsPerBlock = 4096;
+
+    // 创建或清空 _path，_record_size 为 0 时记录为变长
+    explicit RecordFileWriter(const std::string& _path, uint32_t _record_size,
+                              uint32_t _records_per_block = kDefaultRecordsPerBlock);
+    // 使用已有的写入器，文件需要为空
+    explicit RecordFileWriter(FileWriter&& _writer, uint32_t _record_size,
+                              uint32_t _records_per_block = kDefaultRecordsPerBlock);
+    RecordFileWriter(const RecordFileWriter&) = delete;
+    RecordFileWriter& operator = (const RecordFileWriter&) = delete;
+    ~RecordFileWriter() {
+        this->finish();
+    }
+
+    explicit operator bool() const {
+        return bool(this->_writer) && !this->_failed;
+    }
+
+    // 追加一条记录，定长记录的大小必须等于 record_size
+    bool append(const void* _record, size_t _size);
+    bool append(const std::string& _record) {
+        return this->append(_record.data(), _record.size());
+    }
+    template<typename Tp>
+    bool appendRecord(const Tp& _record)
+    {
+        static_assert(std::is_trivially_copyable<Tp>::value, "record must be trivially copyable");
+        return this->append((const void*)&_record, sizeof(Tp));
+    }
+
+    // 写入最后一块、索引和头部，之后不能再追加
+    bool finish();
+
+    uint64_t count() const {
+        return this->_header.record_count;
+    }
+
+private:
+    void init(uint32_t _record_size, uint32_t _records_per_block);
+    bool writeBytes(const void* _data, size_t _size);
+    void endBlock();
+
+private:
+    FileWriter _writer;
+    RecordFileHeader _header {};
+    std::vector<RecordBlockIndex> _blocks;
+    std::vector<uint32_t> _offsets;     // 变长记录在块内的偏移
+    uint64_t _offset {0};               // 当前写入位置
+    uint64_t _block_start {0};          // 当前块起始位置
+    uint32_t _block_records {0};        // 当前块中的记录数
+    uint32_t _block_crc {0};            // 当前块的 CRC32C
+    bool _failed {false};
+    bool _finished {false};
+
+}; // RecordFileWriter
+
+class RecordFileReader
+{
+public:
+    // 映射并检查文件头和索引，块数据在 verify 时才检查
+    static RecordFileReader open(const std::string& _path);
+
+    RecordFileReader() = default;
+    RecordFileReader(RecordFileReader&&) = default;
+    RecordFileReader& operator = (RecordFileReader&&) = default;
+
+    explicit operator bool() const {
+        return this->_error == nullptr;
+    }
+    const char* errorMsg() const {
+        return this->_error == nullptr ? "" : this->_error;
+    }
+
+    uint64_t count() const {
+        return this->_header == nullptr ? 0 : this->_header->record_count;
+    }
+    uint32_t recordSize() const {
+        return this->_header == nullptr ? 0 : this->_header->record_size;
+    }
+    uint64_t blockCount() const {
+        return this->_header == nullptr ? 0 : this->_header->block_count;
+    }
+
+    // 按编号获取记录，越界返回空记录，可以在多个线程中同时调用
+    RecordView record(uint64_t _index) const;
+    template<typename Tp>
+    const Tp* recordAs(uint64_t _index) const
+    {
+        auto view = this->record(_index);
+        return view.size == sizeof(Tp) ? (const Tp*)view.data : nullptr;
+    }
+
+    // 检查一块或全部块的校验和
+    bool verifyBlock(uint64_t _block) const;
+    bool verify() const;
+
+    // 顺序遍历 [_first, _last) 的记录，回调返回 false 时停止，返回遍历的记录数
+    size_t scan(uint64_t _first, uint64_t _last,
+                const std::function<bool(uint64_t, const RecordView&)>& _callback) const;
+
+private:
+    MappedFile _map;
+    const RecordFileHeader* _header {nullptr};
+    const RecordBlockIndex* _blocks {nullptr};
+    const uint32_t* _offsets {nullptr};
+    const char* _error {"not opened"};
+
+}; // RecordFileReader
+
+#endif // __LINUX_STUDY_FILE_TOOL_RECORD_FILE_H
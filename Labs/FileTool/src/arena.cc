@@ -0,0 +1,61 @@
+/**
+* @File arena.cc
+* @Date 2023-04-21
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "arena.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+char* Arena::allocate(size_t _size, size_t _align)
+{
+    _align = std::max(_align, size_t(1));
+    while (this->_current < this->_blocks.size()) {
+        auto& block = this->_blocks[this->_current];
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+        size_t offset = size_t((base + this->_offset + _align - 1) & ~uintptr_t(_align - 1)) - size_t(base);
+        if (offset + _size <= block.size) {
+            this->_offset = offset + _size;
+            this->_used += _size;
+            return block.data.get() + offset;
+        }
+        // 后面还有块可用时跳过当前块剩余的空间
+        if (this->_current + 1 < this->_blocks.size() && this->_blocks[this->_current + 1].size >= _size + _align - 1) {
+            ++this->_current;
+            this->_offset = 0;
+            continue;
+        }
+        break;
+    }
+    // 新块插在当前块之后，重置后按顺序重复使用
+    size_t size = std::max(this->_block_size, _size + _align - 1);
+    size_t index = this->_blocks.empty() ? 0 : this->_current + 1;
+    this->_blocks.insert(this->_blocks.begin() + index, Block {std::unique_ptr<char[]>(new char[size]), size});
+    this->_current = index;
+    this->_offset = 0;
+    return this->allocate(_size, _align);
+}
+
+char* Arena::copy(const void* _data, size_t _size)
+{
+    char* dst = this->allocate(_size);
+    if (_size != 0) {
+        std::memcpy(dst, _data, _size);
+    }
+    return dst;
+}
+
+size_t Arena::capacity() const
+{
+    size_t total = 0;
+    for (auto& block : this->_blocks) {
+        total += block.size;
+    }
+    return total;
+}
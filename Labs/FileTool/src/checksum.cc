@@ -0,0 +1,426 @@
+/**
+* @File checksum.cc
+* @Date 2023-04-12
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "checksum.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <thread>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace
+{
+    const uint32_t kCrc32cPoly = 0x82F63B78u;
+
+    // 软件实现使用的 slicing-by-8 查找表
+    struct Crc32cTables
+    {
+        uint32_t table[8][256];
+        Crc32cTables()
+        {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int j = 0; j < 8; ++j) {
+                    crc = (crc >> 1) ^ (kCrc32cPoly & (0u - (crc & 1u)));
+                }
+                this->table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int k = 1; k < 8; ++k) {
+                    uint32_t prev = this->table[k - 1][i];
+                    this->table[k][i] = (prev >> 8) ^ this->table[0][prev & 0xFFu];
+                }
+            }
+        }
+    };
+
+    const Crc32cTables& crcTables()
+    {
+        static const Crc32cTables tables;
+        return tables;
+    }
+
+    inline uint32_t load32(const File::byte* _p)
+    {
+        uint32_t v;
+        std::memcpy(&v, _p, sizeof(v));
+        return v;
+    }
+
+    inline uint64_t load64(const File::byte* _p)
+    {
+        uint64_t v;
+        std::memcpy(&v, _p, sizeof(v));
+        return v;
+    }
+
+    // _state 为取反后的寄存器值，返回同样形式
+    uint32_t crc32cSoftware(uint32_t _state, const File::byte* _p, size_t _n)
+    {
+        auto& t = crcTables().table;
+        while (_n >= 8) {
+            uint32_t one = _state ^ le32toh(load32(_p));
+            uint32_t two = le32toh(load32(_p + 4));
+            _state = t[7][one & 0xFFu] ^ t[6][(one >> 8) & 0xFFu] ^ t[5][(one >> 16) & 0xFFu] ^ t[4][one >> 24]
+                   ^ t[3][two & 0xFFu] ^ t[2][(two >> 8) & 0xFFu] ^ t[1][(two >> 16) & 0xFFu] ^ t[0][two >> 24];
+            _p += 8;
+            _n -= 8;
+        }
+        while (_n-- > 0) {
+            _state = t[0][(_state ^ *_p++) & 0xFFu] ^ (_state >> 8);
+        }
+        return _state;
+    }
+
+    // GF(2) 上 32x32 矩阵，表示 CRC 寄存器输入若干个 0 之后的线性变换
+    struct Gf2Matrix
+    {
+        uint32_t rows[32];
+    };
+
+    uint32_t gf2Times(const Gf2Matrix& _mat, uint32_t _vec)
+    {
+        uint32_t sum = 0;
+        for (int i = 0; _vec != 0; ++i, _vec >>= 1) {
+            if (_vec & 1u) {
+                sum ^= _mat.rows[i];
+            }
+        }
+        return sum;
+    }
+
+    // 返回 _a * _b，先应用 _b 再应用 _a
+    Gf2Matrix gf2Multiply(const Gf2Matrix& _a, const Gf2Matrix& _b)
+    {
+        Gf2Matrix res {};
+        for (int i = 0; i < 32; ++i) {
+            res.rows[i] = gf2Times(_a, _b.rows[i]);
+        }
+        return res;
+    }
+
+    // 输入 _len 个 0 字节的变换矩阵
+    Gf2Matrix zerosOperator(size_t _len)
+    {
+        // 一个 0 比特的变换
+        Gf2Matrix power {};
+        power.rows[0] = kCrc32cPoly;
+        for (int i = 1; i < 32; ++i) {
+            power.rows[i] = 1u << (i - 1);
+        }
+        // 平方三次得到一个 0 字节的变换
+        for (int i = 0; i < 3; ++i) {
+            power = gf2Multiply(power, power);
+        }
+        Gf2Matrix res {};
+        for (int i = 0; i < 32; ++i) {
+            res.rows[i] = 1u << i;
+        }
+        while (_len != 0) {
+            if (_len & 1u) {
+                res = gf2Multiply(power, res);
+            }
+            _len >>= 1;
+            if (_len != 0) {
+                power = gf2Multiply(power, power);
+            }
+        }
+        return res;
+    }
+
+#if defined(__x86_64__)
+    // 三路交错计算的块大小，crc32 指令延迟为 3 个周期，交错后可以流水执行
+    const size_t kHwBlock = 4096;
+
+    const Gf2Matrix& hwBlockOperator()
+    {
+        static const Gf2Matrix op = zerosOperator(kHwBlock);
+        return op;
+    }
+
+    __attribute__((target("sse4.2")))
+    uint32_t crc32cHardware(uint32_t _state, const File::byte* _p, size_t _n)
+    {
+        while (_n > 0 && (uintptr_t(_p) & 7u) != 0) {
+            _state = _mm_crc32_u8(_state, *_p++);
+            --_n;
+        }
+        auto& op = hwBlockOperator();
+        while (_n >= 3 * kHwBlock) {
+            uint64_t a = _state, b = 0xFFFFFFFFu, c = 0xFFFFFFFFu;
+            const File::byte* pa = _p;
+            const File::byte* pb = _p + kHwBlock;
+            const File::byte* pc = _p + 2 * kHwBlock;
+            for (size_t i = 0; i < kHwBlock; i += 8) {
+                a = _mm_crc32_u64(a, load64(pa + i));
+                b = _mm_crc32_u64(b, load64(pb + i));
+                c = _mm_crc32_u64(c, load64(pc + i));
+            }
+            // 按 combine 的方式合并三段，crc(A+B) = op(crc(A)) ^ crc(B)
+            uint32_t crc = ~uint32_t(a);
+            crc = gf2Times(op, crc) ^ ~uint32_t(b);
+            crc = gf2Times(op, crc) ^ ~uint32_t(c);
+            _state = ~crc;
+            _p += 3 * kHwBlock;
+            _n -= 3 * kHwBlock;
+        }
+        uint64_t state = _state;
+        while (_n >= 8) {
+            state = _mm_crc32_u64(state, load64(_p));
+            _p += 8;
+            _n -= 8;
+        }
+        _state = uint32_t(state);
+        while (_n-- > 0) {
+            _state = _mm_crc32_u8(_state, *_p++);
+        }
+        return _state;
+    }
+#endif
+
+    unsigned threadCount(unsigned _count)
+    {
+        return _count != 0 ? _count : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // 计算文件 [_start, _start + _count) 的校验和
+    uint32_t crc32cRange(const File& _file, const MappedFile& _map, size_t _start, size_t _count, size_t _chunk)
+    {
+        uint32_t crc = 0;
+        if (_map.data() != nullptr) {
+            for (size_t off = 0; off < _count; off += _chunk) {
+                crc = Crc32c::compute(_map.data() + _start + off, std::min(_chunk, _count - off), crc);
+            }
+            return crc;
+        }
+        std::vector<File::byte> buf(std::min(_chunk, _count));
+        for (size_t off = 0; off < _count; ) {
+            size_t len = _file.multiReadBytes(buf.data(), _start + off, std::min(buf.size(), _count - off));
+            if (len == 0) {
+                break;
+            }
+            crc = Crc32c::compute(buf.data(), len, crc);
+            off += len;
+        }
+        return crc;
+    }
+}
+
+bool Crc32c::hardwareSupported()
+{
+#if defined(__x86_64__)
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+uint32_t Crc32c::compute(const void* _data, size_t _size, uint32_t _crc)
+{
+    auto p = (const File::byte*)_data;
+#if defined(__x86_64__)
+    if (Crc32c::hardwareSupported()) {
+        return ~crc32cHardware(~_crc, p, _size);
+    }
+#endif
+    return ~crc32cSoftware(~_crc, p, _size);
+}
+
+uint32_t Crc32c::combine(uint32_t _crc1, uint32_t _crc2, size_t _len2)
+{
+    if (_len2 == 0) {
+        return _crc1;
+    }
+    return gf2Times(zerosOperator(_len2), _crc1) ^ _crc2;
+}
+
+uint32_t Crc32c::zeros(size_t _count)
+{
+    if (_count == 0) {
+        return 0;
+    }
+    return ~gf2Times(zerosOperator(_count), 0xFFFFFFFFu);
+}
+
+uint32_t Crc32c::ofFile(const File& _file, const FileOptions& _options)
+{
+    size_t size = size_t(_file.size());
+    size_t chunk = std::max(_options.chunk_size, size_t(4096));
+    MappedFile map;
+    if (_options.use_mmap) {
+        map = MappedFile::map(_file);
+        map.advise(MADV_SEQUENTIAL);
+    }
+    unsigned thread_count = threadCount(_options.thread_count);
+    // 每个线程至少处理几个块，太小的文件不值得并行
+    thread_count = unsigned(std::min(size_t(thread_count), std::max(size_t(1), size / (chunk * 4))));
+    if (thread_count <= 1) {
+        return crc32cRange(_file, map, 0, size, chunk);
+    }
+
+    // 分段并行计算，再按顺序合并
+    size_t part = (size / thread_count + chunk - 1) / chunk * chunk;
+    std::vector<uint32_t> crcs(thread_count, 0);
+    std::vector<size_t> lens(thread_count, 0);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < thread_count; ++i) {
+        size_t start = std::min(size, part * i);
+        lens[i] = std::min(part, size - start);
+        threads.emplace_back([&, i, start]() {
+            crcs[i] = crc32cRange(_file, map, start, lens[i], chunk);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    uint32_t crc = crcs[0];
+    for (unsigned i = 1; i < thread_count; ++i) {
+        crc = Crc32c::combine(crc, crcs[i], lens[i]);
+    }
+    return crc;
+}
+
+namespace
+{
+    const uint64_t kPrime1 = 11400714785074694791ULL;
+    const uint64_t kPrime2 = 14029467366897019727ULL;
+    const uint64_t kPrime3 = 1609587929392839161ULL;
+    const uint64_t kPrime4 = 9650029242287828579ULL;
+    const uint64_t kPrime5 = 2870177450012600261ULL;
+
+    inline uint64_t rotl64(uint64_t _x, int _r)
+    {
+        return (_x << _r) | (_x >> (64 - _r));
+    }
+
+    inline uint64_t hashRound(uint64_t _acc, uint64_t _input)
+    {
+        _acc += _input * kPrime2;
+        _acc = rotl64(_acc, 31);
+        return _acc * kPrime1;
+    }
+
+    inline uint64_t hashMerge(uint64_t _acc, uint64_t _val)
+    {
+        _acc ^= hashRound(0, _val);
+        return _acc * kPrime1 + kPrime4;
+    }
+}
+
+void Hash64::reset(uint64_t _seed)
+{
+    this->_seed = _seed;
+    this->_acc[0] = _seed + kPrime1 + kPrime2;
+    this->_acc[1] = _seed + kPrime2;
+    this->_acc[2] = _seed;
+    this->_acc[3] = _seed - kPrime1;
+    this->_total = 0;
+    this->_buf_len = 0;
+}
+
+void Hash64::update(const void* _data, size_t _size)
+{
+    auto p = (const File::byte*)_data;
+    auto end = p + _size;
+    this->_total += _size;
+    // 先补满上次剩余的 32 字节
+    if (this->_buf_len + _size < 32) {
+        std::memcpy(this->_buf + this->_buf_len, p, _size);
+        this->_buf_len += _size;
+        return;
+    }
+    if (this->_buf_len > 0) {
+        size_t fill = 32 - this->_buf_len;
+        std::memcpy(this->_buf + this->_buf_len, p, fill);
+        for (int i = 0; i < 4; ++i) {
+            this->_acc[i] = hashRound(this->_acc[i], le64toh(load64(this->_buf + i * 8)));
+        }
+        p += fill;
+        this->_buf_len = 0;
+    }
+    uint64_t v1 = this->_acc[0], v2 = this->_acc[1], v3 = this->_acc[2], v4 = this->_acc[3];
+    while (p + 32 <= end) {
+        v1 = hashRound(v1, le64toh(load64(p)));
+        v2 = hashRound(v2, le64toh(load64(p + 8)));
+        v3 = hashRound(v3, le64toh(load64(p + 16)));
+        v4 = hashRound(v4, le64toh(load64(p + 24)));
+        p += 32;
+    }
+    this->_acc[0] = v1;
+    this->_acc[1] = v2;
+    this->_acc[2] = v3;
+    this->_acc[3] = v4;
+    this->_buf_len = size_t(end - p);
+    std::memcpy(this->_buf, p, this->_buf_len);
+}
+
+uint64_t Hash64::digest() const
+{
+    uint64_t h;
+    if (this->_total >= 32) {
+        h = rotl64(this->_acc[0], 1) + rotl64(this->_acc[1], 7) + rotl64(this->_acc[2], 12) + rotl64(this->_acc[3], 18);
+        for (int i = 0; i < 4; ++i) {
+            h = hashMerge(h, this->_acc[i]);
+        }
+    } else {
+        h = this->_seed + kPrime5;
+    }
+    h += this->_total;
+
+    const File::byte* p = this->_buf;
+    const File::byte* end = p + this->_buf_len;
+    while (p + 8 <= end) {
+        h ^= hashRound(0, le64toh(load64(p)));
+        h = rotl64(h, 27) * kPrime1 + kPrime4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= uint64_t(le32toh(load32(p))) * kPrime1;
+        h = rotl64(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p++) * kPrime5;
+        h = rotl64(h, 11) * kPrime1;
+    }
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Hash64::compute(const void* _data, size_t _size, uint64_t _seed)
+{
+    Hash64 hash(_seed);
+    hash.update(_data, _size);
+    return hash.digest();
+}
+
+uint64_t Hash64::ofFile(const File& _file, uint64_t _seed)
+{
+    Hash64 hash(_seed);
+    auto map = MappedFile::map(_file);
+    if (map.data() != nullptr) {
+        map.advise(MADV_SEQUENTIAL);
+        hash.update(map.data(), map.size());
+        return hash.digest();
+    }
+    std::vector<File::byte> buf(size_t(1) << 20);
+    size_t offset = 0, len;
+    while ((len = _file.multiReadBytes(buf.data(), offset, buf.size())) > 0) {
+        hash.update(buf.data(), len);
+        offset += len;
+    }
+    return hash.digest();
+}
@@ -0,0 +1,247 @@
+/**
+* @File dir_walker.cc
+* @Date 2023-04-09
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "dir_walker.h"
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    // getdents64 返回的目录项结构
+    struct LinuxDirent64
+    {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    const size_t kDentsBufSize = 64 * 1024;
+
+    bool isDotOrDotDot(const char* _name)
+    {
+        return _name[0] == '.' && (_name[1] == '\0' || (_name[1] == '.' && _name[2] == '\0'));
+    }
+
+    unsigned char modeToType(mode_t _mode)
+    {
+        return (unsigned char)IFTODT(_mode);
+    }
+}
+
+std::string DirEntry::path() const
+{
+    std::string path;
+    path.reserve(this->dir_path->size() + std::strlen(this->name) + 1);
+    path += *this->dir_path;
+    if (!path.empty() && path.back() != '/') {
+        path += '/';
+    }
+    path += this->name;
+    return path;
+}
+
+size_t DirWalker::walk(const std::string& _root, const Callback& _callback)
+{
+    unsigned thread_count = this->_options.thread_count;
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    this->_callback = &_callback;
+    this->_stop.store(false);
+    this->_entry_count.store(0);
+    this->_error_count.store(0);
+    this->_loop_count.store(0);
+    this->_error.store(0);
+    this->_idle.store(0);
+    this->_queues.clear();
+    for (unsigned i = 0; i < thread_count; ++i) {
+        this->_queues.emplace_back(new TaskQueue);
+    }
+
+    this->pushTask(0, Task{nullptr, _root, _root, 0, nullptr});
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned i = 1; i < thread_count; ++i) {
+        threads.emplace_back(&DirWalker::workerLoop, this, i);
+    }
+    this->workerLoop(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+    this->_queues.clear();
+    this->_callback = nullptr;
+    return this->_entry_count.load();
+}
+
+void DirWalker::workerLoop(size_t _index)
+{
+    std::vector<char> buf(kDentsBufSize);
+    Task task;
+    while (true) {
+        if (this->popTask(_index, task) || this->stealTask(_index, task)) {
+            if (!this->_stop.load(std::memory_order_relaxed)) {
+                this->processDir(_index, task, buf);
+            }
+            task.parent.reset();
+            if (this->_pending.fetch_sub(1) == 1) {
+                // 最后一个目录处理完成，唤醒所有等待的线程退出
+                std::lock_guard<std::mutex> lock(this->_idle_lock);
+                this->_idle_cond.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(this->_idle_lock);
+        this->_idle.fetch_add(1);
+        this->_idle_cond.wait(lock, [this]() {
+            return this->_queued.load() > 0 || this->_pending.load() == 0;
+        });
+        this->_idle.fetch_sub(1);
+        if (this->_pending.load() == 0) {
+            break;
+        }
+    }
+}
+
+void DirWalker::processDir(size_t _index, Task& _task, std::vector<char>& _buf)
+{
+    int open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (!this->_options.follow_links && _task.depth > 0) {
+        open_flags |= O_NOFOLLOW;
+    }
+    int fd;
+    if (_task.parent) {
+        fd = ::openat(_task.parent->fd, _task.name.data(), open_flags);
+    } else {
+        fd = ::open(_task.path.data(), open_flags);
+    }
+    // 子目录打开后不再需要父目录
+    _task.parent.reset();
+    if (fd < 0) {
+        this->setError(errno);
+        return;
+    }
+    auto handle = std::make_shared<DirHandle>(fd);
+
+    std::shared_ptr<const DirNode> node;
+    if (this->_options.follow_links) {
+        struct stat64 dir_st {};
+        if (::fstat64(fd, &dir_st) != 0) {
+            this->setError(errno);
+            return;
+        }
+        for (auto it = _task.ancestors.get(); it != nullptr; it = it->parent.get()) {
+            if (it->dev == dir_st.st_dev && it->ino == dir_st.st_ino) {
+                // 符号链接指回祖先目录，继续进入会无限循环
+                this->_loop_count.fetch_add(1);
+                return;
+            }
+        }
+        node = std::make_shared<const DirNode>(DirNode{dir_st.st_dev, dir_st.st_ino, std::move(_task.ancestors)});
+    }
+
+    const Callback& callback = *this->_callback;
+    struct stat64 st {};
+    bool need_stat = this->_options.stat_entries;
+    size_t count = 0;
+    while (!this->_stop.load(std::memory_order_relaxed)) {
+        long len = ::syscall(SYS_getdents64, fd, _buf.data(), _buf.size());
+        if (len <= 0) {
+            if (len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                this->setError(errno);
+            }
+            break;
+        }
+        for (long pos = 0; pos < len; ) {
+            auto* dent = (LinuxDirent64*)(_buf.data() + pos);
+            pos += dent->d_reclen;
+            if (isDotOrDotDot(dent->d_name)) {
+                continue;
+            }
+            DirEntry entry {fd, &_task.path, dent->d_name, dent->d_ino, dent->d_type, _task.depth, nullptr};
+            // d_type 足够判断类型时不需要 stat
+            bool follow = this->_options.follow_links && entry.type == DT_LNK;
+            if (need_stat || follow || entry.type == DT_UNKNOWN) {
+                if (::fstatat64(fd, dent->d_name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+                    entry.type = modeToType(st.st_mode);
+                    entry.stat = &st;
+                }
+            }
+            ++count;
+            bool descend = callback(entry);
+            if (descend && entry.type == DT_DIR && _task.depth + 1 <= this->_options.max_depth) {
+                std::string path = entry.path();
+                this->pushTask(_index, Task{handle, dent->d_name, std::move(path), _task.depth + 1, node});
+            }
+        }
+    }
+    this->_entry_count.fetch_add(count);
+}
+
+void DirWalker::pushTask(size_t _index, Task&& _task)
+{
+    this->_pending.fetch_add(1);
+    {
+        auto& queue = *this->_queues[_index];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.tasks.push_back(std::move(_task));
+    }
+    this->_queued.fetch_add(1);
+    if (this->_idle.load() > 0) {
+        std::lock_guard<std::mutex> lock(this->_idle_lock);
+        this->_idle_cond.notify_one();
+    }
+}
+
+void DirWalker::setError(int _error)
+{
+    this->_error_count.fetch_add(1);
+    int expected = 0;
+    this->_error.compare_exchange_strong(expected, _error);
+}
+
+bool DirWalker::popTask(size_t _index, Task& _task)
+{
+    auto& queue = *this->_queues[_index];
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    // 优先处理最新的子目录，深度优先，打开的目录描述符更少
+    _task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    this->_queued.fetch_sub(1);
+    return true;
+}
+
+bool DirWalker::stealTask(size_t _index, Task& _task)
+{
+    size_t count = this->_queues.size();
+    for (size_t i = 1; i < count; ++i) {
+        auto& queue = *this->_queues[(_index + i) % count];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        // 窃取最早放入的目录，通常是更大的子树
+        _task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        this->_queued.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,279 @@
+/**
+* @File direct_io.cc
+* @Date 2023-04-19
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "direct_io.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    size_t alignDown(size_t _value, size_t _align)
+    {
+        return _value / _align * _align;
+    }
+
+    size_t alignUp(size_t _value, size_t _align)
+    {
+        return (_value + _align - 1) / _align * _align;
+    }
+
+    bool isAligned(const void* _ptr, size_t _align)
+    {
+        return reinterpret_cast<uintptr_t>(_ptr) % _align == 0;
+    }
+
+    // 原子地取较小值
+    void storeMin(std::atomic<size_t>& _target, size_t _value)
+    {
+        size_t current = _target.load();
+        while (_value < current && !_target.compare_exchange_weak(current, _value)) {}
+    }
+}
+
+AlignedBuffer::AlignedBuffer(size_t _size, size_t _align)
+    : _align(std::max(_align, sizeof(void*)))
+{
+    this->reserve(_size);
+}
+
+AlignedBuffer::~AlignedBuffer()
+{
+    std::free(this->_data);
+}
+
+AlignedBuffer& AlignedBuffer::operator = (AlignedBuffer&& _buf) noexcept
+{
+    if (this != &_buf) {
+        std::free(this->_data);
+        this->_data = _buf._data;
+        this->_size = _buf._size;
+        this->_align = _buf._align;
+        _buf._data = nullptr;
+        _buf._size = 0;
+    }
+    return *this;
+}
+
+bool AlignedBuffer::reserve(size_t _size)
+{
+    size_t size = alignUp(std::max(_size, size_t(1)), this->_align);
+    if (size <= this->_size) {
+        return true;
+    }
+    std::free(this->_data);
+    this->_data = nullptr;
+    this->_size = 0;
+    void* data = nullptr;
+    if (::posix_memalign(&data, this->_align, size) != 0) {
+        return false;
+    }
+    this->_data = (File::byte*)data;
+    this->_size = size;
+    return true;
+}
+
+DirectIO::DirectIO(const Options& _options)
+    : _options(_options)
+{
+    auto& opt = this->_options;
+    opt.alignment = std::max(opt.alignment, size_t(512));
+    opt.block_size = alignUp(std::max(opt.block_size, opt.alignment), opt.alignment);
+    opt.queue_depth = std::max(1u, opt.queue_depth);
+}
+
+template<typename Func>
+void DirectIO::forEachPiece(size_t _start, size_t _end, Func&& _func) const
+{
+    size_t block = this->_options.block_size;
+    size_t piece_count = (_end - _start + block - 1) / block;
+    std::atomic<size_t> next {0};
+    auto worker = [&]() {
+        AlignedBuffer bounce(0, this->_options.alignment);
+        size_t index;
+        while ((index = next.fetch_add(1)) < piece_count) {
+            size_t start = _start + index * block;
+            _func(start, std::min(start + block, _end), bounce);
+        }
+    };
+    // 每个线程同时只有一个请求，线程数就是队列深度
+    size_t thread_count = std::min(size_t(this->_options.queue_depth), piece_count);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+size_t DirectIO::read(const File& _file, void* _buf, size_t _offset, size_t _count) const
+{
+    if (_count == 0) {
+        return 0;
+    }
+    size_t align = this->_options.alignment;
+    size_t end = _offset + _count;
+    auto buf = (File::byte*)_buf;
+    // 第一次读取不完整的位置，之后的数据都不算读到
+    std::atomic<size_t> short_at {std::numeric_limits<size_t>::max()};
+
+    this->forEachPiece(alignDown(_offset, align), alignUp(end, align),
+                       [&](size_t _start, size_t _stop, AlignedBuffer& _bounce) {
+        size_t user_start = std::max(_start, _offset);
+        size_t user_end = std::min(_stop, end);
+        File::byte* dst = buf + (user_start - _offset);
+        size_t got;
+        if (user_start == _start && user_end == _stop && isAligned(dst, align)) {
+            got = _file.multiReadBytes(dst, _start, _stop - _start);
+        } else {
+            if (!_bounce.reserve(this->_options.block_size)) {
+                storeMin(short_at, _start);
+                return;
+            }
+            got = _file.multiReadBytes(_bounce.data(), _start, _stop - _start);
+            size_t valid_end = std::min(user_end, _start + got);
+            if (valid_end > user_start) {
+                std::memcpy(dst, _bounce.data() + (user_start - _start), valid_end - user_start);
+            }
+        }
+        if (got < _stop - _start) {
+            storeMin(short_at, _start + got);
+        }
+    });
+
+    size_t valid_end = std::min(end, short_at.load());
+    return valid_end > _offset ? valid_end - _offset : 0;
+}
+
+size_t DirectIO::write(const File& _file, const void* _buf, size_t _offset, size_t _count) const
+{
+    if (_count == 0) {
+        return 0;
+    }
+    size_t align = this->_options.alignment;
+    size_t end = _offset + _count;
+    auto buf = (const File::byte*)_buf;
+    size_t old_size = size_t(_file.refreshStat(FileStat::kSize).size());
+    std::atomic<size_t> short_at {std::numeric_limits<size_t>::max()};
+
+    // 不对齐的头尾块落在原文件内时需要读出原有内容，只写打开的文件无法读取
+    auto needRead = [&](size_t _pos) {
+        return _pos % align != 0 && alignDown(_pos, align) < old_size;
+    };
+    if ((_file._open_flags & O_ACCMODE) == O_WRONLY && (needRead(_offset) || needRead(end))) {
+        errno = EBADF;
+        return 0;
+    }
+
+    // 读出不完整的块，只有超出原文件尾的部分补 0，原有内容没有读全时返回 false
+    auto readBlock = [&](File::byte* _dst, size_t _pos) {
+        size_t expect = _pos < old_size ? std::min(align, old_size - _pos) : 0;
+        size_t got = expect > 0 ? _file.multiReadBytes(_dst, _pos, align) : 0;
+        if (got < expect) {
+            return false;
+        }
+        std::memset(_dst + got, 0, align - got);
+        return true;
+    };
+
+    size_t aligned_end = alignUp(end, align);
+    this->forEachPiece(alignDown(_offset, align), aligned_end,
+                       [&](size_t _start, size_t _stop, AlignedBuffer& _bounce) {
+        size_t user_start = std::max(_start, _offset);
+        size_t user_end = std::min(_stop, end);
+        const File::byte* src = buf + (user_start - _offset);
+        size_t put;
+        if (user_start == _start && user_end == _stop && isAligned(src, align)) {
+            put = _file.multiWriteBytes(File::bytePtr(src), _start, _stop - _start);
+        } else {
+            if (!_bounce.reserve(this->_options.block_size)) {
+                storeMin(short_at, _start);
+                return;
+            }
+            // 读不出原有内容时不写入，避免用 0 覆盖相邻的数据
+            bool ok = true;
+            if (user_start > _start) {
+                ok = readBlock(_bounce.data(), _start);
+            }
+            if (ok && user_end < _stop && (_stop - align > _start || user_start == _start)) {
+                ok = readBlock(_bounce.data() + (_stop - align - _start), _stop - align);
+            }
+            if (!ok) {
+                storeMin(short_at, _start);
+                return;
+            }
+            std::memcpy(_bounce.data() + (user_start - _start), src, user_end - user_start);
+            put = _file.multiWriteBytes(_bounce.data(), _start, _stop - _start);
+        }
+        if (put < _stop - _start) {
+            storeMin(short_at, _start + put);
+        }
+    });
+
+    // 尾部按整块写入，文件可能被多扩展了一部分
+    size_t valid_end = std::min(end, short_at.load());
+    size_t final_size = std::max(old_size, valid_end);
+    if (std::min(aligned_end, short_at.load()) > final_size) {
+        if (::ftruncate64(_file._fd, off64_t(final_size)) != 0) {
+            return 0;
+        }
+        _file.invalidateStat();
+    }
+    return valid_end > _offset ? valid_end - _offset : 0;
+}
+
+bool DirectIO::scan(const File& _file, const ScanCallback& _callback) const
+{
+    size_t size = size_t(_file.refreshStat(FileStat::kSize).size());
+    size_t block = this->_options.block_size;
+    size_t batch = block * this->_options.queue_depth;
+    AlignedBuffer bufs[2] = {
+        AlignedBuffer(batch, this->_options.alignment),
+        AlignedBuffer(batch, this->_options.alignment),
+    };
+    if (!bufs[0] || !bufs[1]) {
+        return false;
+    }
+
+    size_t offset = 0;
+    int current = 0;
+    size_t len = size > 0 ? this->read(_file, bufs[0].data(), 0, std::min(batch, size)) : 0;
+    while (len > 0) {
+        // 后台读取下一批
+        size_t next_offset = offset + len;
+        size_t next_len = 0;
+        std::thread prefetch;
+        if (next_offset < size) {
+            prefetch = std::thread([&, next_offset]() {
+                next_len = this->read(_file, bufs[current ^ 1].data(), next_offset, std::min(batch, size - next_offset));
+            });
+        }
+        bool keep = true;
+        for (size_t pos = 0; keep && pos < len; pos += block) {
+            keep = _callback(off64_t(offset + pos), bufs[current].data() + pos, std::min(block, len - pos));
+        }
+        if (prefetch.joinable()) {
+            prefetch.join();
+        }
+        if (!keep) {
+            return true;
+        }
+        offset = next_offset;
+        len = next_len;
+        current ^= 1;
+    }
+    return offset >= size;
+}
@@ -0,0 +1,262 @@
+/**
+* @File file_cache.cc
+* @Date 2023-04-17
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_cache.h"
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+    // 目录中会使缓存失效的事件
+    const uint32_t kDirEvents = IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF;
+    const size_t kMinCapacity = 16;
+
+    std::string dirName(const std::string& _path)
+    {
+        auto pos = _path.find_last_of('/');
+        if (pos == std::string::npos) {
+            return ".";
+        }
+        return pos == 0 ? "/" : _path.substr(0, pos);
+    }
+
+    std::string makeKey(const std::string& _path, int _flags)
+    {
+        std::string key = _path;
+        key.push_back('\0');
+        key.append(std::to_string(_flags));
+        return key;
+    }
+}
+
+FileCache::FileCache(const Options& _options)
+    : _options(_options)
+{
+    // 给缓存之外的文件描述符留出一半余量
+    struct rlimit limit {};
+    size_t fd_limit = ::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+                    ? size_t(limit.rlim_cur) : size_t(1024);
+    this->_capacity = this->_options.capacity != 0 ? std::min(this->_options.capacity, fd_limit / 2)
+                                                   : fd_limit / 2;
+    this->_capacity = std::max(kMinCapacity, this->_capacity);
+
+    unsigned shard_count = std::max(1u, this->_options.shard_count);
+    this->_shard_capacity = std::max(size_t(1), (this->_capacity + shard_count - 1) / shard_count);
+    for (unsigned i = 0; i < shard_count; ++i) {
+        this->_shards.emplace_back(new Shard());
+    }
+
+    if (this->_options.watch_changes) {
+        this->_inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        this->_event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (this->_inotify_fd >= 0 && this->_event_fd >= 0) {
+            this->_watch_thread = std::thread(&FileCache::watchLoop, this);
+        }
+    }
+}
+
+FileCache::~FileCache()
+{
+    if (this->_watch_thread.joinable()) {
+        uint64_t value = 1;
+        if (::write(this->_event_fd, &value, sizeof(value)) == sizeof(value)) {
+            this->_watch_thread.join();
+        } else {
+            this->_watch_thread.detach();
+        }
+    }
+    if (this->_inotify_fd >= 0) {
+        ::close(this->_inotify_fd);
+    }
+    if (this->_event_fd >= 0) {
+        ::close(this->_event_fd);
+    }
+}
+
+FileCache::Shard& FileCache::shardOf(const std::string& _path)
+{
+    // 按路径分片，同一路径的不同打开方式在同一分片中，方便一起失效
+    return *this->_shards[std::hash<std::string>()(_path) % this->_shards.size()];
+}
+
+FileCache::Handle FileCache::open(const std::string& _path, int _flags)
+{
+    std::string key = makeKey(_path, _flags);
+    Shard& shard = this->shardOf(_path);
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            this->_hit_count.fetch_add(1, std::memory_order_relaxed);
+            return it->second->file;
+        }
+    }
+    this->_miss_count.fetch_add(1, std::memory_order_relaxed);
+
+    // 打开文件时不持有锁，其他线程同时打开时使用先放入缓存的
+    std::shared_ptr<File> file(new File(_path, _flags));
+    if (!*file) {
+        errno = file->_error;
+        return nullptr;
+    }
+    if (this->_inotify_fd >= 0) {
+        this->watchDir(_path);
+    }
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        // 没有放入缓存，不占用目录的监视
+        this->unwatchDir(_path);
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->file;
+    }
+    shard.lru.push_front(Entry {key, _path, file});
+    shard.index.emplace(key, shard.lru.begin());
+    while (shard.lru.size() > this->_shard_capacity) {
+        this->eraseEntry(shard, std::prev(shard.lru.end()));
+    }
+    return file;
+}
+
+void FileCache::invalidate(const std::string& _path)
+{
+    Shard& shard = this->shardOf(_path);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    for (auto it = shard.lru.begin(); it != shard.lru.end(); ) {
+        if (it->path == _path) {
+            it = this->eraseEntry(shard, it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FileCache::clear()
+{
+    for (auto& shard : this->_shards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        for (auto it = shard->lru.begin(); it != shard->lru.end(); ) {
+            it = this->eraseEntry(*shard, it);
+        }
+    }
+}
+
+auto FileCache::eraseEntry(Shard& _shard, std::list<Entry>::iterator _it) -> std::list<Entry>::iterator
+{
+    this->unwatchDir(_it->path);
+    _shard.index.erase(_it->key);
+    return _shard.lru.erase(_it);
+}
+
+size_t FileCache::size() const
+{
+    size_t total = 0;
+    for (auto& shard : this->_shards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        total += shard->lru.size();
+    }
+    return total;
+}
+
+void FileCache::watchDir(const std::string& _path)
+{
+    std::string dir = dirName(_path);
+    std::lock_guard<std::mutex> guard(this->_watch_lock);
+    ++this->_dir_refs[dir];
+    if (this->_dir_watches.count(dir) != 0) {
+        return;
+    }
+    int wd = ::inotify_add_watch(this->_inotify_fd, dir.c_str(), kDirEvents | IN_ONLYDIR);
+    if (wd < 0) {
+        return;
+    }
+    this->_dir_watches[dir] = wd;
+    this->_watch_dirs[wd] = dir;
+}
+
+void FileCache::unwatchDir(const std::string& _path)
+{
+    std::string dir = dirName(_path);
+    std::lock_guard<std::mutex> guard(this->_watch_lock);
+    auto ref = this->_dir_refs.find(dir);
+    if (ref == this->_dir_refs.end() || --ref->second != 0) {
+        return;
+    }
+    this->_dir_refs.erase(ref);
+    auto it = this->_dir_watches.find(dir);
+    if (it == this->_dir_watches.end()) {
+        return;
+    }
+    // 之后收到的 IN_IGNORED 找不到对应的目录，直接忽略
+    ::inotify_rm_watch(this->_inotify_fd, it->second);
+    this->_watch_dirs.erase(it->second);
+    this->_dir_watches.erase(it);
+}
+
+void FileCache::watchLoop()
+{
+    alignas(struct inotify_event) char buf[4096];
+    while (true) {
+        struct pollfd fds[2] = {
+            {this->_inotify_fd, POLLIN, 0},
+            {this->_event_fd, POLLIN, 0},
+        };
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+        ssize_t len;
+        while ((len = ::read(this->_inotify_fd, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + len; ) {
+                auto event = (struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + event->len;
+                std::string dir;
+                {
+                    std::lock_guard<std::mutex> guard(this->_watch_lock);
+                    auto it = this->_watch_dirs.find(event->wd);
+                    if (it == this->_watch_dirs.end()) {
+                        continue;
+                    }
+                    dir = it->second;
+                    if (event->mask & IN_IGNORED) {
+                        this->_dir_watches.erase(dir);
+                        this->_watch_dirs.erase(it);
+                    }
+                }
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    // 目录本身被移走，其中的路径全部失效
+                    std::string prefix = dir == "/" ? dir : dir + "/";
+                    for (auto& shard : this->_shards) {
+                        std::lock_guard<std::mutex> guard(shard->lock);
+                        for (auto it = shard->lru.begin(); it != shard->lru.end(); ) {
+                            if (it->path.compare(0, prefix.size(), prefix) == 0 || (dir == "." && it->path.find('/') == std::string::npos)) {
+                                it = this->eraseEntry(*shard, it);
+                            } else {
+                                ++it;
+                            }
+                        }
+                    }
+                } else if (event->len > 0) {
+                    this->invalidate(dir == "." ? std::string(event->name) : (dir == "/" ? dir : dir + "/") + event->name);
+                }
+            }
+        }
+    }
+}
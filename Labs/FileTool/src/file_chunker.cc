@@ -0,0 +1,189 @@
+/**
+* @File file_chunker.cc
+* @Date 2023-04-16
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_chunker.h"
+#include "checksum.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+    // gear 表，每个字节对应一个随机数，用 splitmix64 固定生成，保证不同进程的分块结果一致
+    struct GearTable
+    {
+        uint64_t values[256];
+
+        GearTable()
+        {
+            uint64_t seed = 0x4c696e7578537475ULL;
+            for (auto& value : this->values) {
+                seed += 0x9e3779b97f4a7c15ULL;
+                uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                value = z ^ (z >> 31);
+            }
+        }
+    };
+
+    const GearTable kGear;
+
+    // 取哈希值最高的 _bits 位作为掩码，左移后高位包含最近 64 个字节的信息
+    uint64_t topBitsMask(unsigned _bits)
+    {
+        _bits = std::min(63u, std::max(1u, _bits));
+        return ((uint64_t(1) << _bits) - 1) << (64 - _bits);
+    }
+}
+
+FileChunker::FileChunker(const Options& _options)
+    : _options(_options)
+{
+    auto& opt = this->_options;
+    opt.min_size = std::max(size_t(64), opt.min_size);
+    opt.avg_size = std::max(opt.min_size, opt.avg_size);
+    opt.max_size = std::max(opt.avg_size, opt.max_size);
+    opt.buffer_size = std::max(opt.max_size * 2, opt.buffer_size);
+    unsigned bits = 0;
+    while ((size_t(1) << (bits + 1)) <= opt.avg_size) {
+        ++bits;
+    }
+    // 归一化分块：平均大小前后使用不同难度的掩码，块大小更集中在平均值附近
+    this->_mask_small = topBitsMask(bits + 2);
+    this->_mask_large = topBitsMask(bits - 2);
+}
+
+size_t FileChunker::cutPoint(const File::byte* _data, size_t _size) const
+{
+    if (_size <= this->_options.min_size) {
+        return _size;
+    }
+    size_t normal = std::min(this->_options.avg_size, _size);
+    size_t limit = std::min(this->_options.max_size, _size);
+    uint64_t fp = 0;
+    size_t i = this->_options.min_size;
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + kGear.values[_data[i]];
+        if ((fp & this->_mask_small) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; ++i) {
+        fp = (fp << 1) + kGear.values[_data[i]];
+        if ((fp & this->_mask_large) == 0) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+FileChunk FileChunker::makeChunk(const File::byte* _data, size_t _size, off64_t _offset) const
+{
+    return FileChunk {_offset, uint32_t(_size), Crc32c::compute(_data, _size), Hash64::compute(_data, _size)};
+}
+
+std::vector<FileChunk> FileChunker::chunk(const void* _data, size_t _size, off64_t _base) const
+{
+    std::vector<FileChunk> chunks;
+    auto data = (const File::byte*)_data;
+    size_t pos = 0;
+    while (pos < _size) {
+        size_t len = this->cutPoint(data + pos, _size - pos);
+        chunks.push_back(this->makeChunk(data + pos, len, _base + off64_t(pos)));
+        pos += len;
+    }
+    return chunks;
+}
+
+std::vector<FileChunk> FileChunker::chunkFile(const File& _file) const
+{
+    std::vector<FileChunk> chunks;
+    this->forEachChunk(_file, [&](const FileChunk& _chunk, const File::byte*) {
+        chunks.push_back(_chunk);
+        return true;
+    });
+    return chunks;
+}
+
+bool FileChunker::forEachChunk(const File& _file, const ChunkCallback& _callback) const
+{
+    std::vector<File::byte> buf(this->_options.buffer_size);
+    off64_t size = _file.size();
+    off64_t file_pos = 0;       // 缓冲区开头在文件中的位置
+    size_t begin = 0, end = 0;
+    while (file_pos + off64_t(begin) < size) {
+        // 剩余数据不足一个最大块时补充，保证切分点和一次读完整个文件时相同
+        if (end - begin < this->_options.max_size && file_pos + off64_t(end) < size) {
+            std::memmove(buf.data(), buf.data() + begin, end - begin);
+            file_pos += off64_t(begin);
+            end -= begin;
+            begin = 0;
+            size_t want = size_t(std::min(off64_t(buf.size() - end), size - file_pos - off64_t(end)));
+            size_t len = _file.multiReadBytes(buf.data() + end, size_t(file_pos) + end, want);
+            if (len == 0) {
+                return false;
+            }
+            end += len;
+            continue;
+        }
+        size_t len = this->cutPoint(buf.data() + begin, end - begin);
+        auto chunk = this->makeChunk(buf.data() + begin, len, file_pos + off64_t(begin));
+        if (!_callback(chunk, buf.data() + begin)) {
+            return false;
+        }
+        begin += len;
+    }
+    return true;
+}
+
+bool FileChunker::deltaSync(const File& _source, const File& _target, SyncStats* _stats) const
+{
+    SyncStats stats;
+    if (_source._fd < 0 || _target._fd < 0) {
+        return false;
+    }
+    // 源文件大小必须是确定的，否则可能把目标截断成错误的大小，目标也按当前大小读取
+    auto source_stat = _source.refreshStat(FileStat::kSize);
+    if (!source_stat || !_target.refreshStat(FileStat::kSize)) {
+        return false;
+    }
+    // 目标文件原有的块按偏移索引，读取失败时不知道哪些块可以复用
+    std::unordered_map<off64_t, FileChunk> existing;
+    bool ok = this->forEachChunk(_target, [&](const FileChunk& _chunk, const File::byte*) {
+        existing.emplace(_chunk.offset, _chunk);
+        return true;
+    });
+    if (!ok) {
+        return false;
+    }
+    ok = this->forEachChunk(_source, [&](const FileChunk& _chunk, const File::byte* _data) {
+        ++stats.chunk_count;
+        auto it = existing.find(_chunk.offset);
+        if (it != existing.end() && it->second.sameContent(_chunk)) {
+            stats.reused_bytes += _chunk.length;
+            return true;
+        }
+        // constBytePtr 是指针本身为常量，需要去掉内容的 const
+        size_t len = _target.multiWriteBytes(File::bytePtr(_data), size_t(_chunk.offset), _chunk.length);
+        ++stats.changed_count;
+        stats.written_bytes += len;
+        return len == _chunk.length;
+    });
+    // 源文件全部分块写入成功后才调整目标大小
+    off64_t size = source_stat.size();
+    if (ok && _target.refreshStat(FileStat::kSize).size() != size) {
+        ok = ::ftruncate64(_target._fd, size) == 0;
+        _target.invalidateStat();
+    }
+    if (_stats != nullptr) {
+        *_stats = stats;
+    }
+    return ok;
+}
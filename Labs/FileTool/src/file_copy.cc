@@ -0,0 +1,333 @@
+/**
+* @File file_copy.cc
+* @Date 2023-04-08
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_copy.h"
+#include <sys/sendfile.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace
+{
+    // 单次系统调用最多拷贝的字节数
+    const size_t kMaxCopyOnce = size_t(1) << 30;
+    // 并行拷贝时每个任务的最小大小
+    const size_t kMinParallelPiece = size_t(16) << 20;
+    const int kMaxRetryCount = 3;
+    // 检测全 0 数据的块大小
+    const size_t kZeroBlockSize = 4096;
+
+    // 当前拷贝方式不被支持，应该换下一种方式
+    bool notSupported(int _error)
+    {
+        return _error == EXDEV || _error == EINVAL || _error == ENOSYS
+            || _error == EOPNOTSUPP || _error == EBADF || _error == ETXTBSY;
+    }
+}
+
+size_t FileCopier::copy(const File& _src, const File& _dst) const
+{
+    if (_src._fd < 0 || _dst._fd < 0) {
+        return 0;
+    }
+    // 同一个文件时截断目标就是清空源文件
+    if (_src.sameFile(_dst)) {
+        return 0;
+    }
+    auto size = _src.size();
+    // 先截断再扩展，目标文件中原有内容全部变为空洞，未拷贝的区域自然为 0
+    bool truncated = ::ftruncate64(_dst._fd, 0) == 0 && ::ftruncate64(_dst._fd, size) == 0;
+    _dst.invalidateStat();
+    if (!truncated) {
+        return 0;
+    }
+    auto ranges = FileCopier::dataRanges(_src._fd, size, this->_options.keep_sparse);
+
+    unsigned thread_count = this->_options.thread_count;
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    Crc32c* checksum = this->_options.checksum;
+    // 只允许 sendfile 时无法按偏移并行写入
+    bool can_parallel = checksum != nullptr || (this->_options.strategy & ~kSendFile) != 0;
+    if (size_t(size) < this->_options.parallel_threshold) {
+        thread_count = 1;
+    }
+    if (checksum == nullptr && (!can_parallel || thread_count == 1)) {
+        size_t total = 0;
+        for (auto& range : ranges) {
+            size_t len = this->copyRange(_src._fd, _dst._fd, range.offset, range.length);
+            total += len;
+            if (len < range.length) {
+                // 失败时目标只保留完整拷贝的部分，不留下补 0 的尾部
+                ::ftruncate64(_dst._fd, range.offset + off64_t(len));
+                break;
+            }
+        }
+        _dst.invalidateStat();
+        return total;
+    }
+
+    // 将数据区域切分为多个小任务，线程按顺序领取，大文件的多个区域同时拷贝
+    size_t data_size = 0;
+    for (auto& range : ranges) {
+        data_size += range.length;
+    }
+    size_t piece_size = std::max(kMinParallelPiece, data_size / (thread_count * 4));
+    std::vector<Range> pieces;
+    for (auto& range : ranges) {
+        for (size_t start = 0; start < range.length; start += piece_size) {
+            pieces.push_back({range.offset + off64_t(start), std::min(piece_size, range.length - start), false});
+        }
+    }
+    thread_count = unsigned(std::max(size_t(1), std::min(size_t(thread_count), pieces.size())));
+    // 每一段单独计算校验和，最后按顺序合并
+    std::vector<uint32_t> crcs(checksum != nullptr ? pieces.size() : 0, 0);
+
+    std::atomic<size_t> next {0};
+    std::atomic<size_t> total {0};
+    // 第一个没有拷贝完整的位置
+    std::atomic<off64_t> short_at {size};
+    auto worker = [&]() {
+        size_t index;
+        while ((index = next.fetch_add(1)) < pieces.size()) {
+            auto& piece = pieces[index];
+            size_t len;
+            if (checksum != nullptr) {
+                len = this->copyByBuffer(_src._fd, _dst._fd, piece.offset, piece.length, &crcs[index]);
+            } else {
+                len = this->copyRange(_src._fd, _dst._fd, piece.offset, piece.length, true);
+            }
+            total.fetch_add(len);
+            if (len < piece.length) {
+                off64_t pos = piece.offset + off64_t(len);
+                off64_t current = short_at.load();
+                while (pos < current && !short_at.compare_exchange_weak(current, pos)) {}
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (short_at.load() < size) {
+        // 失败时目标只保留完整拷贝的前缀，不留下补 0 的尾部
+        ::ftruncate64(_dst._fd, short_at.load());
+    }
+    _dst.invalidateStat();
+
+    if (checksum != nullptr) {
+        // 空洞部分按 0 字节合并
+        uint32_t crc = 0;
+        off64_t pos = 0;
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            if (pieces[i].offset > pos) {
+                size_t gap = size_t(pieces[i].offset - pos);
+                crc = Crc32c::combine(crc, Crc32c::zeros(gap), gap);
+            }
+            crc = Crc32c::combine(crc, crcs[i], pieces[i].length);
+            pos = pieces[i].offset + off64_t(pieces[i].length);
+        }
+        if (size > pos) {
+            size_t gap = size_t(size - pos);
+            crc = Crc32c::combine(crc, Crc32c::zeros(gap), gap);
+        }
+        *checksum = Crc32c(Crc32c::combine(checksum->value(), crc, size_t(size)));
+    }
+    return total.load();
+}
+
+size_t FileCopier::copyRange(int _in_fd, int _out_fd, off64_t _offset, size_t _count, bool _parallel) const
+{
+    // 需要检查数据内容时只能经过用户空间
+    int strategy = this->_options.detect_zeros ? int(kBuffered) : this->_options.strategy;
+    size_t total = 0;
+    if (total < _count && (strategy & kCopyFileRange)) {
+        total += this->copyByCopyFileRange(_in_fd, _out_fd, _offset + off64_t(total), _count - total);
+    }
+    // sendfile 写入位置依赖目标文件偏移，并行时不能使用
+    if (total < _count && (strategy & kSendFile) && !_parallel) {
+        total += this->copyBySendFile(_in_fd, _out_fd, _offset + off64_t(total), _count - total);
+    }
+    if (total < _count && (strategy & kSplice)) {
+        total += this->copyBySplice(_in_fd, _out_fd, _offset + off64_t(total), _count - total);
+    }
+    if (total < _count && (strategy & kBuffered)) {
+        total += this->copyByBuffer(_in_fd, _out_fd, _offset + off64_t(total), _count - total);
+    }
+    return total;
+}
+
+std::vector<FileCopier::Range> FileCopier::dataRanges(int _fd, off64_t _size, bool _keep_sparse)
+{
+    if (!_keep_sparse) {
+        std::vector<Range> ranges;
+        if (_size > 0) {
+            ranges.push_back({0, size_t(_size), false});
+        }
+        return ranges;
+    }
+    return File::seekExtents(_fd, 0, _size, false);
+}
+
+size_t FileCopier::copyByCopyFileRange(int _in_fd, int _out_fd, off64_t _offset, size_t _count) const
+{
+    int retry_count = 0;
+    size_t total = 0;
+    loff_t in_off = _offset, out_off = _offset;
+    while (retry_count < kMaxRetryCount && total < _count) {
+        ssize_t len = ::copy_file_range(_in_fd, &in_off, _out_fd, &out_off,
+                                        std::min(kMaxCopyOnce, _count - total), 0);
+        if (len > 0) {
+            total += len;
+        } else {
+            if (len == 0 || notSupported(errno)) {
+                break;
+            }
+            if (errno != EINTR) {
+                ++retry_count;
+            }
+        }
+    }
+    return total;
+}
+
+size_t FileCopier::copyBySendFile(int _in_fd, int _out_fd, off64_t _offset, size_t _count) const
+{
+    if (::lseek64(_out_fd, _offset, SEEK_SET) != _offset) {
+        return 0;
+    }
+    int retry_count = 0;
+    size_t total = 0;
+    off64_t in_off = _offset;
+    while (retry_count < kMaxRetryCount && total < _count) {
+        ssize_t len = ::sendfile64(_out_fd, _in_fd, &in_off, std::min(kMaxCopyOnce, _count - total));
+        if (len > 0) {
+            total += len;
+        } else {
+            if (len == 0 || notSupported(errno)) {
+                break;
+            }
+            if (errno != EINTR) {
+                ++retry_count;
+            }
+        }
+    }
+    return total;
+}
+
+size_t FileCopier::copyBySplice(int _in_fd, int _out_fd, off64_t _offset, size_t _count) const
+{
+    int pipe_fds[2];
+    if (::pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        return 0;
+    }
+    // 尽量扩大管道，减少 splice 次数
+    long pipe_size = ::fcntl(pipe_fds[1], F_SETPIPE_SZ, int(this->_options.buffer_size));
+    if (pipe_size <= 0) {
+        pipe_size = ::fcntl(pipe_fds[1], F_GETPIPE_SZ);
+    }
+
+    int retry_count = 0;
+    size_t total = 0;
+    loff_t in_off = _offset, out_off = _offset;
+    bool failed = false;
+    while (!failed && retry_count < kMaxRetryCount && total < _count) {
+        ssize_t in_len = ::splice(_in_fd, &in_off, pipe_fds[1], nullptr,
+                                  std::min(size_t(pipe_size), _count - total), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_len <= 0) {
+            if (in_len == 0 || notSupported(errno)) {
+                break;
+            }
+            if (errno != EINTR) {
+                ++retry_count;
+            }
+            continue;
+        }
+        // 管道中的数据需要全部写出，否则只能丢弃，由下一种方式重新拷贝
+        while (in_len > 0) {
+            ssize_t out_len = ::splice(pipe_fds[0], nullptr, _out_fd, &out_off,
+                                       size_t(in_len), SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out_len > 0) {
+                in_len -= out_len;
+                total += out_len;
+            } else if (out_len < 0 && errno == EINTR) {
+                continue;
+            } else {
+                failed = true;
+                break;
+            }
+        }
+    }
+    ::close(pipe_fds[0]);
+    ::close(pipe_fds[1]);
+    return total;
+}
+
+size_t FileCopier::copyByBuffer(int _in_fd, int _out_fd, off64_t _offset, size_t _count, uint32_t* _crc) const
+{
+    std::vector<File::byte> buf(std::min(this->_options.buffer_size, _count));
+    int retry_count = 0;
+    size_t total = 0;
+    while (retry_count < kMaxRetryCount && total < _count) {
+        ssize_t len = ::pread64(_in_fd, buf.data(), std::min(buf.size(), _count - total), _offset + off64_t(total));
+        if (len <= 0) {
+            if (len == 0) {
+                break;
+            }
+            if (errno != EINTR) {
+                ++retry_count;
+            }
+            continue;
+        }
+        ssize_t written = 0;
+        while (retry_count < kMaxRetryCount && written < len) {
+            // 全为 0 的块直接跳过，目标文件已经截断，跳过的部分就是空洞
+            if (this->_options.detect_zeros) {
+                size_t block = std::min(kZeroBlockSize, size_t(len - written));
+                if (isAllZero(buf.data() + written, block)) {
+                    written += ssize_t(block);
+                    continue;
+                }
+            }
+            size_t count = size_t(len - written);
+            if (this->_options.detect_zeros) {
+                // 连续的非 0 块一次写入
+                count = 0;
+                while (count < size_t(len - written)) {
+                    size_t block = std::min(kZeroBlockSize, size_t(len - written) - count);
+                    if (count > 0 && isAllZero(buf.data() + written + count, block)) {
+                        break;
+                    }
+                    count += block;
+                }
+            }
+            ssize_t w = ::pwrite64(_out_fd, buf.data() + written, count, _offset + off64_t(total) + written);
+            if (w > 0) {
+                written += w;
+            } else if (errno != EINTR) {
+                ++retry_count;
+            }
+        }
+        if (_crc != nullptr) {
+            *_crc = Crc32c::compute(buf.data(), size_t(written), *_crc);
+        }
+        total += written;
+        if (written < len) {
+            break;
+        }
+    }
+    return total;
+}
@@ -0,0 +1,208 @@
+/**
+* @File file_creator.cc
+* @Date 2023-04-10
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_creator.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+
+namespace
+{
+    // 只在创建时有意义的标志，返回的 File 复制时会按 _open_flags 重新打开，不能带上这些标志
+    const int kCreationFlags = O_CREAT | O_EXCL | O_TRUNC;
+
+    // 所有路径共同的目录前缀长度，包含结尾的 '/'，没有时为 0
+    size_t commonDirPrefix(const std::vector<std::string>& _paths)
+    {
+        const std::string& first = _paths.front();
+        auto index = first.find_last_of('/');
+        size_t len = index == std::string::npos ? 0 : index + 1;
+        for (auto& path : _paths) {
+            size_t n = std::min(len, path.size());
+            size_t i = 0;
+            while (i < n && path[i] == first[i]) {
+                ++i;
+            }
+            // 退回到最后一个完整的目录
+            len = i;
+            while (len > 0 && first[len - 1] != '/') {
+                --len;
+            }
+        }
+        return len;
+    }
+}
+
+FileCreator::FileCreator(std::string _root)
+    : FileCreator(std::move(_root), Options())
+{}
+
+FileCreator::FileCreator(std::string _root, const Options& _options)
+    : _options(_options)
+    , _root(std::move(_root))
+{
+    if (this->_root.empty()) {
+        this->_root = ".";
+    }
+    this->_root_fd = ::open(this->_root.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (this->_root_fd < 0 && errno == ENOENT) {
+        File::createDirs(this->_root, this->_options.dir_mode);
+        this->_root_fd = ::open(this->_root.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+}
+
+FileCreator::~FileCreator()
+{
+    this->clearCache();
+    if (this->_root_fd >= 0) {
+        ::close(this->_root_fd);
+    }
+}
+
+void FileCreator::clearCache()
+{
+    for (auto& it : this->_dir_fds) {
+        ::close(it.second);
+    }
+    this->_dir_fds.clear();
+}
+
+bool FileCreator::create(const std::string& _path)
+{
+    int fd = this->openFd(_path);
+    if (fd < 0) {
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+File FileCreator::open(const std::string& _path)
+{
+    int fd = this->openFd(_path);
+    return File(fd, this->_root + "/" + _path, this->_options.open_flags & ~kCreationFlags);
+}
+
+int FileCreator::openFd(const std::string& _path)
+{
+    auto index = _path.find_last_of('/');
+    int dir_fd = this->_root_fd;
+    const char* name = _path.data();
+    if (index != std::string::npos) {
+        dir_fd = this->dirFd(_path.substr(0, index));
+        name += index + 1;
+    }
+    if (dir_fd < 0) {
+        return -1;
+    }
+    int fd;
+    do {
+        fd = ::openat(dir_fd, name, this->_options.open_flags | O_CLOEXEC, this->_options.file_mode);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+int FileCreator::makeDir(const std::string& _dir)
+{
+    return this->dirFd(_dir);
+}
+
+int FileCreator::dirFd(const std::string& _dir)
+{
+    if (_dir.empty() || _dir == ".") {
+        return this->_root_fd;
+    }
+    auto it = this->_dir_fds.find(_dir);
+    if (it != this->_dir_fds.end()) {
+        return it->second;
+    }
+    // 先获取父目录，递归到缓存中已有的目录为止
+    auto index = _dir.find_last_of('/');
+    int parent_fd = this->_root_fd;
+    const char* name = _dir.data();
+    if (index != std::string::npos) {
+        parent_fd = this->dirFd(_dir.substr(0, index));
+        name += index + 1;
+    }
+    if (parent_fd < 0) {
+        return -1;
+    }
+    // 已知存在的目录直接打开，否则先创建，已存在时忽略错误
+    if (this->_known_dirs.find(_dir) == this->_known_dirs.end()) {
+        if (::mkdirat(parent_fd, name, this->_options.dir_mode) != 0 && errno != EEXIST) {
+            return -1;
+        }
+        this->_known_dirs.insert(_dir);
+    }
+    int fd = ::openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    // 打开的目录太多时全部关闭，已知存在的目录仍然记录，之后只需要重新打开
+    if (this->_dir_fds.size() >= this->_options.max_open_dirs) {
+        this->clearCache();
+    }
+    this->_dir_fds.emplace(_dir, fd);
+    return fd;
+}
+
+size_t FileCreator::createAll(const std::vector<std::string>& _paths)
+{
+    if (this->_options.thread_count <= 1 || _paths.size() < 2) {
+        size_t count = 0;
+        for (auto& path : _paths) {
+            count += this->create(path) ? 1 : 0;
+        }
+        return count;
+    }
+
+    // 跳过所有路径共同的目录，按开始分叉的那一级分组，不同子树之间没有共同的父目录，可以并行创建
+    // 直接位于共同目录下的文件各自成组
+    size_t prefix = commonDirPrefix(_paths);
+    std::map<std::string, std::vector<const std::string*>> groups;
+    for (auto& path : _paths) {
+        auto index = path.find('/', prefix);
+        groups[path.substr(prefix, index == std::string::npos ? std::string::npos : index - prefix)].push_back(&path);
+    }
+    std::vector<const std::vector<const std::string*>*> tasks;
+    for (auto& it : groups) {
+        tasks.push_back(&it.second);
+    }
+    // 大的子树先处理，减少最后的等待
+    std::sort(tasks.begin(), tasks.end(), [](const std::vector<const std::string*>* a,
+                                             const std::vector<const std::string*>* b) {
+        return a->size() > b->size();
+    });
+
+    std::atomic<size_t> next {0};
+    std::atomic<size_t> total {0};
+    auto worker = [&]() {
+        Options options = this->_options;
+        options.thread_count = 1;
+        FileCreator creator(this->_root, options);
+        size_t index, count = 0;
+        while ((index = next.fetch_add(1)) < tasks.size()) {
+            for (auto* path : *tasks[index]) {
+                count += creator.create(*path) ? 1 : 0;
+            }
+        }
+        total.fetch_add(count);
+    };
+    unsigned thread_count = unsigned(std::min(size_t(this->_options.thread_count), tasks.size()));
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    return total.load();
+}
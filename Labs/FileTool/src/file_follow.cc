@@ -0,0 +1,352 @@
+/**
+* @File file_follow.cc
+* @Date 2023-04-13
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_follow.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+
+namespace
+{
+    const uint32_t kFileEvents = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    const uint32_t kDirEvents = IN_CREATE | IN_MOVED_TO;
+
+    std::string baseName(const std::string& _path)
+    {
+        auto pos = _path.find_last_of('/');
+        return pos == std::string::npos ? _path : _path.substr(pos + 1);
+    }
+
+    std::string dirName(const std::string& _path)
+    {
+        auto pos = _path.find_last_of('/');
+        if (pos == std::string::npos) {
+            return ".";
+        }
+        return pos == 0 ? "/" : _path.substr(0, pos);
+    }
+}
+
+FollowReader::FollowReader(std::string _path, const Options& _options)
+    : _path(std::move(_path))
+    , _options(_options)
+{
+    this->_dir = dirName(this->_path);
+    this->_buf.resize(std::max(size_t(4096), this->_options.buffer_size));
+    this->_inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    this->_event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->_inotify_fd < 0 || this->_event_fd < 0) {
+        this->_error = errno;
+    }
+}
+
+FollowReader::~FollowReader()
+{
+    this->closeFile();
+    if (this->_inotify_fd >= 0) {
+        ::close(this->_inotify_fd);
+    }
+    if (this->_event_fd >= 0) {
+        ::close(this->_event_fd);
+    }
+}
+
+std::string FollowReader::nextSegment(const std::string& _path)
+{
+    // RollLogFile 的文件名为 base_name + 序号 + ".log"（LogFile 追加扩展名），app1.log -> app2.log
+    // 文件名以序号结尾时直接递增，app.log1 -> app.log2
+    auto name_pos = _path.find_last_of('/');
+    name_pos = name_pos == std::string::npos ? 0 : name_pos + 1;
+    auto end = _path.size();
+    if (end == name_pos || !std::isdigit((unsigned char)_path[end - 1])) {
+        end = _path.find_last_of('.');
+        if (end == std::string::npos || end < name_pos) {
+            return std::string();
+        }
+    }
+    auto start = end;
+    while (start > name_pos && std::isdigit((unsigned char)_path[start - 1])) {
+        --start;
+    }
+    // 没有序号，或者序号长到不可能是 RollLogFile 生成的
+    if (start == end || end - start > 18) {
+        return std::string();
+    }
+    auto index = std::stoull(_path.substr(start, end - start));
+    return _path.substr(0, start) + std::to_string(index + 1) + _path.substr(end);
+}
+
+void FollowReader::stop()
+{
+    uint64_t value = 1;
+    if (::write(this->_event_fd, &value, sizeof(value)) < 0) {
+        this->_stopped.store(true);
+    }
+}
+
+bool FollowReader::follow(const Callback& _callback)
+{
+    if (this->_inotify_fd < 0 || this->_event_fd < 0) {
+        return false;
+    }
+    this->_callback = &_callback;
+    this->_stopped.store(false);
+    this->_error = 0;
+    // 先监视目录再打开文件，避免错过两者之间创建的文件
+    this->_dir_wd = ::inotify_add_watch(this->_inotify_fd, this->_dir.c_str(), kDirEvents | IN_ONLYDIR);
+    if (this->_dir_wd < 0) {
+        this->_error = errno;
+        return false;
+    }
+    // 文件还不存在时等待创建
+    bool running = this->openFile(!this->_options.from_start) || this->_error == ENOENT;
+    if (running) {
+        this->_error = 0;
+        running = this->readNew() && this->checkRoll();
+    }
+    while (running && !this->_stopped.load()) {
+        struct pollfd fds[2] = {
+            {this->_inotify_fd, POLLIN, 0},
+            {this->_event_fd, POLLIN, 0},
+        };
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            this->_error = errno;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            while (::read(this->_event_fd, &value, sizeof(value)) > 0) {}
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            running = this->handleEvents();
+        }
+    }
+
+    ::inotify_rm_watch(this->_inotify_fd, this->_dir_wd);
+    this->_dir_wd = -1;
+    this->closeFile();
+    this->_callback = nullptr;
+    return this->_error == 0;
+}
+
+bool FollowReader::openFile(bool _seek_end)
+{
+    this->closeFile();
+    this->_offset = 0;
+    this->_partial.clear();
+    this->_fd = ::open(this->_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->_fd < 0) {
+        this->_error = errno;
+        return false;
+    }
+    this->_file_wd = ::inotify_add_watch(this->_inotify_fd, this->_path.c_str(), kFileEvents);
+    if (_seek_end) {
+        struct stat64 st {};
+        if (::fstat64(this->_fd, &st) == 0) {
+            this->_offset = st.st_size;
+        }
+    }
+    return true;
+}
+
+void FollowReader::closeFile()
+{
+    if (this->_file_wd >= 0) {
+        ::inotify_rm_watch(this->_inotify_fd, this->_file_wd);
+        this->_file_wd = -1;
+    }
+    if (this->_fd >= 0) {
+        ::close(this->_fd);
+        this->_fd = -1;
+    }
+}
+
+bool FollowReader::handleEvents()
+{
+    alignas(struct inotify_event) char buf[4096];
+    std::string current = baseName(this->_path);
+    std::string next = this->_options.follow_roll ? baseName(nextSegment(this->_path)) : std::string();
+    bool modified = false, created = false, rolled = false, overflow = false;
+    while (true) {
+        ssize_t len = ::read(this->_inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (char* p = buf; p < buf + len; ) {
+            auto event = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+            } else if (event->wd == this->_dir_wd && event->len > 0) {
+                if (current == event->name) {
+                    created = true;
+                } else if (!next.empty() && next == event->name) {
+                    rolled = true;
+                }
+            } else if (event->wd == this->_file_wd) {
+                modified = true;
+            }
+        }
+    }
+
+    if (overflow) {
+        // 队列溢出时事件已经丢失，重新检查文件内容、是否被替换以及下一个分段
+        modified = true;
+        created = created || this->replaced();
+    }
+
+    // 被移走或删除的文件仍然可以读完剩余内容
+    if (modified && !this->readNew()) {
+        return false;
+    }
+    if (rolled) {
+        return this->switchTo(nextSegment(this->_path)) && this->checkRoll();
+    }
+    if (created) {
+        // 同名文件被重新创建，旧文件已经轮转走
+        return this->switchTo(this->_path) && this->checkRoll();
+    }
+    return !overflow || this->checkRoll();
+}
+
+bool FollowReader::replaced() const
+{
+    struct stat64 path_st {}, fd_st {};
+    if (::stat64(this->_path.c_str(), &path_st) != 0) {
+        return false;
+    }
+    if (this->_fd < 0 || ::fstat64(this->_fd, &fd_st) != 0) {
+        return true;
+    }
+    return path_st.st_dev != fd_st.st_dev || path_st.st_ino != fd_st.st_ino;
+}
+
+bool FollowReader::switchTo(const std::string& _path)
+{
+    // 读完旧文件，最后的不完整行不会再被补全
+    if (!this->readNew()) {
+        return false;
+    }
+    if (!this->_partial.empty()) {
+        std::string last;
+        last.swap(this->_partial);
+        if (!this->pushLine(last.data(), last.size())) {
+            return false;
+        }
+    }
+    if (!this->deliver()) {
+        return false;
+    }
+    this->_path = _path;
+    if (!this->openFile(false)) {
+        // 文件在打开前又被移走，等待下一次创建
+        this->_error = this->_error == ENOENT ? 0 : this->_error;
+        return this->_error == 0;
+    }
+    return this->readNew();
+}
+
+bool FollowReader::checkRoll()
+{
+    if (!this->_options.follow_roll) {
+        return true;
+    }
+    std::string next = nextSegment(this->_path);
+    while (!next.empty() && ::access(next.c_str(), F_OK) == 0) {
+        if (!this->switchTo(next)) {
+            return false;
+        }
+        next = nextSegment(this->_path);
+    }
+    return true;
+}
+
+bool FollowReader::readNew()
+{
+    if (this->_fd < 0) {
+        return true;
+    }
+    // 文件变小说明被截断，从头开始读取
+    struct stat64 st {};
+    if (::fstat64(this->_fd, &st) == 0 && st.st_size < this->_offset) {
+        this->_offset = 0;
+        this->_partial.clear();
+    }
+    while (true) {
+        ssize_t len = ::pread64(this->_fd, this->_buf.data(), this->_buf.size(), this->_offset);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            this->_error = errno;
+            return false;
+        }
+        if (len == 0) {
+            break;
+        }
+        this->_offset += len;
+        const char* data = this->_buf.data();
+        const char* end = data + len;
+        while (data < end) {
+            auto newline = (const char*)std::memchr(data, '\n', size_t(end - data));
+            if (newline == nullptr) {
+                this->_partial.append(data, size_t(end - data));
+                break;
+            }
+            if (this->_partial.empty()) {
+                if (!this->pushLine(data, size_t(newline - data))) {
+                    return false;
+                }
+            } else {
+                this->_partial.append(data, size_t(newline - data));
+                std::string line;
+                line.swap(this->_partial);
+                if (!this->pushLine(line.data(), line.size())) {
+                    return false;
+                }
+            }
+            data = newline + 1;
+        }
+    }
+    return this->deliver();
+}
+
+bool FollowReader::pushLine(const char* _data, size_t _size)
+{
+    this->_lines.emplace_back(_data, _size);
+    if (this->_lines.size() >= this->_options.max_batch) {
+        return this->deliver();
+    }
+    return true;
+}
+
+bool FollowReader::deliver()
+{
+    if (this->_lines.empty()) {
+        return true;
+    }
+    bool keep = (*this->_callback)(this->_lines);
+    this->_lines.clear();
+    if (!keep) {
+        this->_stopped.store(true);
+    }
+    return keep;
+}
@@ -0,0 +1,236 @@
+/**
+* @File file_pipeline.cc
+* @Date 2023-04-18
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_pipeline.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    // 有界阻塞队列，关闭后 push 失败，pop 取完剩余元素后失败
+    template<typename Tp>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t _capacity)
+            : _capacity(_capacity)
+        {}
+
+        bool push(Tp _value)
+        {
+            std::unique_lock<std::mutex> lock(this->_lock);
+            this->_not_full.wait(lock, [this]() {
+                return this->_closed || this->_items.size() < this->_capacity;
+            });
+            if (this->_closed) {
+                return false;
+            }
+            this->_items.push_back(std::move(_value));
+            this->_not_empty.notify_one();
+            return true;
+        }
+
+        bool pop(Tp& _value)
+        {
+            std::unique_lock<std::mutex> lock(this->_lock);
+            this->_not_empty.wait(lock, [this]() {
+                return this->_closed || !this->_items.empty();
+            });
+            if (this->_items.empty()) {
+                return false;
+            }
+            _value = std::move(this->_items.front());
+            this->_items.pop_front();
+            this->_not_full.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> guard(this->_lock);
+            this->_closed = true;
+            this->_not_empty.notify_all();
+            this->_not_full.notify_all();
+        }
+
+    private:
+        size_t _capacity;
+        bool _closed {false};
+        std::deque<Tp> _items;
+        std::mutex _lock;
+        std::condition_variable _not_empty;
+        std::condition_variable _not_full;
+    };
+}
+
+bool FilePipeline::run(const std::string& _input, const std::string& _output, const Transform& _transform)
+{
+    FileReader reader(File::open(_input, File::kReadOnly));
+    FileWriter writer(File::create(_output, 0644), this->_options.chunk_size);
+    // 输出和输入是同一个文件时截断会在读取之前清空输入
+    if (!reader || !writer || writer.file().sameFile(reader.file())) {
+        return false;
+    }
+    if (::ftruncate64(writer.file()._fd, 0) != 0) {
+        return false;
+    }
+    bool ok = this->run(reader, writer, _transform);
+    writer.flush();
+    return ok && writer.pending() == 0;
+}
+
+bool FilePipeline::run(FileReader& _reader, FileWriter& _writer, const Transform& _transform)
+{
+    this->_stats = Stats();
+    unsigned worker_count = this->_options.worker_count;
+    if (worker_count == 0) {
+        worker_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t depth = this->_options.queue_depth != 0 ? this->_options.queue_depth : size_t(worker_count) * 2 + 2;
+    size_t chunk_size = std::max(size_t(4096), this->_options.chunk_size);
+    bool line_aligned = this->_options.line_aligned;
+
+    // 所有缓冲区提前分配，之后在空闲队列和工作队列之间循环
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    BoundedQueue<Chunk*> free_queue(depth);
+    BoundedQueue<Chunk*> work_queue(depth);
+    for (size_t i = 0; i < depth; ++i) {
+        chunks.emplace_back(new Chunk());
+        chunks.back()->input.resize(chunk_size);
+        free_queue.push(chunks.back().get());
+    }
+
+    // 转换完成的块按序号放入对应位置，在途的块不超过 depth 个，位置不会冲突
+    std::mutex done_lock;
+    std::condition_variable done_cond;
+    std::vector<Chunk*> done(depth, nullptr);
+    bool read_done = false;
+    size_t total_chunks = 0;
+    std::atomic<bool> failed {false};
+    std::atomic<uint64_t> read_bytes {0};
+
+    auto fail = [&]() {
+        std::lock_guard<std::mutex> guard(done_lock);
+        failed.store(true);
+        done_cond.notify_all();
+    };
+
+    std::thread reader([&]() {
+        std::vector<File::byte> carry;      // 上一块末尾不完整的行
+        size_t index = 0;
+        off64_t offset = 0;
+        Chunk* chunk;
+        bool eof = false;
+        while (!eof && !failed.load() && free_queue.pop(chunk)) {
+            if (chunk->input.size() < carry.size() + chunk_size) {
+                chunk->input.resize(carry.size() + chunk_size);
+            }
+            std::copy(carry.begin(), carry.end(), chunk->input.begin());
+            chunk->size = carry.size();
+            carry.clear();
+            while (true) {
+                while (!eof && chunk->size < chunk->input.size()) {
+                    size_t len = _reader.readRecords(chunk->input.data() + chunk->size, chunk->input.size() - chunk->size);
+                    if (len == 0) {
+                        eof = true;
+                    }
+                    chunk->size += len;
+                }
+                if (!line_aligned || eof) {
+                    break;
+                }
+                auto begin = chunk->input.data();
+                auto last = (const File::byte*)memrchr(begin, '\n', chunk->size);
+                if (last != nullptr) {
+                    size_t end = size_t(last - begin) + 1;
+                    carry.assign(begin + end, begin + chunk->size);
+                    chunk->size = end;
+                    break;
+                }
+                // 一行比块还长
+                chunk->input.resize(chunk->input.size() * 2);
+            }
+            if (chunk->size == 0) {
+                free_queue.push(chunk);
+                break;
+            }
+            chunk->index = index++;
+            chunk->offset = offset;
+            offset += off64_t(chunk->size);
+            read_bytes.fetch_add(chunk->size);
+            if (!work_queue.push(chunk)) {
+                break;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(done_lock);
+            read_done = true;
+            total_chunks = index;
+            done_cond.notify_all();
+        }
+        work_queue.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < worker_count; ++i) {
+        workers.emplace_back([&]() {
+            Chunk* chunk;
+            while (work_queue.pop(chunk)) {
+                chunk->output.clear();
+                if (!failed.load() && !_transform(*chunk)) {
+                    fail();
+                }
+                std::lock_guard<std::mutex> guard(done_lock);
+                done[chunk->index % depth] = chunk;
+                done_cond.notify_all();
+            }
+        });
+    }
+
+    // 当前线程按顺序写出
+    size_t next = 0;
+    while (true) {
+        Chunk* chunk;
+        {
+            std::unique_lock<std::mutex> lock(done_lock);
+            done_cond.wait(lock, [&]() {
+                return failed.load() || done[next % depth] != nullptr || (read_done && next >= total_chunks);
+            });
+            chunk = done[next % depth];
+            if (failed.load() || chunk == nullptr) {
+                break;
+            }
+            done[next % depth] = nullptr;
+        }
+        size_t len = _writer.write(chunk->output.data(), chunk->output.size());
+        this->_stats.written_bytes += len;
+        ++next;
+        if (len != chunk->output.size()) {
+            fail();
+            break;
+        }
+        free_queue.push(chunk);
+    }
+
+    free_queue.close();
+    work_queue.close();
+    reader.join();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    this->_stats.chunk_count = next;
+    this->_stats.read_bytes = read_bytes.load();
+    return !failed.load();
+}
@@ -0,0 +1,532 @@
+/**
+* @File file_sorter.cc
+* @Date 2023-04-15
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "file_sorter.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+namespace
+{
+    // 每个归并输入的最小缓冲区
+    const size_t kMinMergeBuffer = size_t(64) << 10;
+    // 每个排序线程最少处理的数量，太少时不值得开线程
+    const size_t kMinItemsPerThread = 16384;
+    // 每一行或每条记录的 Item 占用的内存
+    const size_t kItemOverhead = 32;
+    // 一次归并最多同时打开的有序段，超过时先分组归并成更少的段
+    const size_t kMaxMergeFanIn = 256;
+
+    // 有序段的顺序读取器，每次取出一行或一条记录
+    class RunReader
+    {
+    public:
+        RunReader(const std::string& _path, size_t _buffer_size, size_t _record_size)
+            : _reader(File::open(_path, File::kReadOnly))
+            , _record_size(_record_size)
+        {
+            this->_buf.resize(std::max(_buffer_size, _record_size));
+        }
+
+        explicit operator bool() const {
+            return bool(this->_reader);
+        }
+        File& file() {
+            return this->_reader.file();
+        }
+        const LineView& current() const {
+            return this->_current;
+        }
+
+        // 取出下一项，没有时返回 false
+        bool next()
+        {
+            while (true) {
+                size_t avail = this->_end - this->_begin;
+                const char* start = this->_buf.data() + this->_begin;
+                if (this->_record_size != 0) {
+                    if (avail >= this->_record_size) {
+                        this->_current = LineView{start, this->_record_size};
+                        this->_begin += this->_record_size;
+                        return true;
+                    }
+                } else {
+                    auto newline = (const char*)std::memchr(start, '\n', avail);
+                    if (newline != nullptr) {
+                        this->_current = LineView{start, size_t(newline - start)};
+                        this->_begin += size_t(newline - start) + 1;
+                        return true;
+                    }
+                }
+                if (this->_eof) {
+                    // 有序段中每一行都以换行符结尾，剩余的内容不完整
+                    return false;
+                }
+                this->fill();
+            }
+        }
+
+    private:
+        void fill()
+        {
+            // 剩余部分移到开头，一行比缓冲区还长时扩展缓冲区
+            size_t avail = this->_end - this->_begin;
+            std::memmove(this->_buf.data(), this->_buf.data() + this->_begin, avail);
+            this->_begin = 0;
+            this->_end = avail;
+            if (this->_end == this->_buf.size()) {
+                this->_buf.resize(this->_buf.size() * 2);
+            }
+            size_t len = this->_reader.readRecords(this->_buf.data() + this->_end, this->_buf.size() - this->_end);
+            if (len == 0) {
+                this->_eof = true;
+            }
+            this->_end += len;
+        }
+
+    private:
+        FileReader _reader;
+        size_t _record_size;
+        std::vector<char> _buf;
+        size_t _begin {0};
+        size_t _end {0};
+        bool _eof {false};
+        LineView _current {nullptr, 0};
+    };
+
+    // 败者树，内部节点保存败者，_tree[0] 保存胜者，-1 表示比任何输入都小的哨兵
+    template<typename Beats>
+    class LoserTree
+    {
+    public:
+        LoserTree(size_t _count, Beats _beats)
+            : _count(_count)
+            , _tree(std::max(size_t(1), _count), -1)
+            , _beats(_beats)
+        {
+            for (size_t i = _count; i > 0; --i) {
+                this->adjust(int(i - 1));
+            }
+        }
+
+        int top() const {
+            return this->_tree[0];
+        }
+
+        // 输入 _index 的当前项改变后从叶子向上重新比较
+        void adjust(int _index)
+        {
+            int winner = _index;
+            for (size_t t = (size_t(_index) + this->_count) / 2; t > 0; t /= 2) {
+                if (this->_beats(this->_tree[t], winner)) {
+                    std::swap(winner, this->_tree[t]);
+                }
+            }
+            this->_tree[0] = winner;
+        }
+
+    private:
+        size_t _count;
+        std::vector<int> _tree;
+        Beats _beats;
+    };
+
+    template<typename Beats>
+    LoserTree<Beats> makeLoserTree(size_t _count, Beats _beats)
+    {
+        return LoserTree<Beats>(_count, _beats);
+    }
+
+    std::string tempRunPath(const std::string& _dir)
+    {
+        static std::atomic<size_t> counter {0};
+        return _dir + "/file_sort." + std::to_string(::getpid()) + "." + std::to_string(counter.fetch_add(1)) + ".run";
+    }
+
+    // 一次归并的路数，给输入输出和其他文件描述符留出一半余量
+    size_t mergeFanIn()
+    {
+        struct rlimit limit {};
+        size_t fd_limit = ::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+                        ? size_t(limit.rlim_cur) : size_t(1024);
+        return std::max(size_t(2), std::min(kMaxMergeFanIn, fd_limit / 2));
+    }
+}
+
+unsigned FileSorter::threadCount() const
+{
+    unsigned thread_count = this->_options.thread_count;
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return thread_count;
+}
+
+bool FileSorter::sort(const std::string& _input, const std::string& _output)
+{
+    this->_error = 0;
+    this->_run_count = 0;
+    FileReader reader(File::open(_input, File::kReadOnly));
+    if (!reader) {
+        this->_error = reader.file()._error;
+        return false;
+    }
+    FileWriter writer(File::create(_output, 0644), this->_options.buffer_size);
+    if (writer && writer.file().sameFile(reader.file())) {
+        // 输出和输入是同一个文件时截断会在读取之前清空输入
+        this->_error = EINVAL;
+        return false;
+    }
+    if (!writer || ::ftruncate64(writer.file()._fd, 0) != 0) {
+        this->_error = writer.file()._error != 0 ? writer.file()._error : errno;
+        return false;
+    }
+
+    // 两块内存交替使用，一块在后台排序写入时读取另一块
+    // 按行排序时每块的数据、Item 和留给下一块的剩余内容各占三分之一，短行很多时按行数截断
+    size_t half = std::max(size_t(1) << 16, this->_options.memory_budget / 2);
+    size_t record_size = this->_options.record_size;
+    size_t capacity = record_size != 0 ? half / (record_size + kItemOverhead) * record_size
+                                       : half / 3;
+    capacity = std::max(capacity, std::max(record_size, size_t(4096)));
+    size_t max_items = record_size != 0 ? capacity / record_size
+                                        : std::max(size_t(1), half / 3 / kItemOverhead);
+
+    Chunk chunks[2];
+    std::string carry;
+    std::vector<std::string> runs;
+    std::thread spiller;
+    size_t index = 0;
+    bool single = false;
+    while (this->_error == 0 && this->readChunk(reader, chunks[index], carry, capacity, max_items)) {
+        // 只有一块数据时直接在内存中排序写入输出
+        if (runs.empty() && reader.file().size() <= off64_t(chunks[index].size)) {
+            single = true;
+            this->sortChunk(chunks[index]);
+            if (!this->writeChunk(chunks[index], writer)) {
+                this->_error = writer.file()._error != 0 ? writer.file()._error : EIO;
+            }
+            break;
+        }
+        if (spiller.joinable()) {
+            spiller.join();
+        }
+        runs.push_back(tempRunPath(this->_options.temp_dir));
+        Chunk* chunk = &chunks[index];
+        std::string path = runs.back();
+        spiller = std::thread([this, chunk, path]() {
+            this->spillChunk(*chunk, path);
+        });
+        index ^= 1;
+    }
+    if (spiller.joinable()) {
+        spiller.join();
+    }
+    this->_run_count = single ? 1 : runs.size();
+
+    if (this->_error == 0 && !runs.empty()) {
+        this->reduceRuns(runs);
+    }
+    if (this->_error == 0 && !runs.empty()) {
+        this->mergeRuns(runs, writer);
+    }
+    for (auto& run : runs) {
+        ::unlink(run.c_str());
+    }
+    if (this->_error == 0) {
+        writer.flush();
+        if (writer.pending() != 0) {
+            this->_error = EIO;
+        }
+    }
+    return this->_error == 0;
+}
+
+bool FileSorter::readChunk(FileReader& _reader, Chunk& _chunk, std::string& _carry, size_t _capacity, size_t _max_items)
+{
+    size_t record_size = this->_options.record_size;
+    _chunk.data.resize(std::max(_capacity, _carry.size() + 4096));
+    std::memcpy(_chunk.data.data(), _carry.data(), _carry.size());
+    _chunk.size = _carry.size();
+    _carry.clear();
+
+    bool eof = false;
+    while (true) {
+        while (!eof && _chunk.size < _chunk.data.size()) {
+            size_t len = _reader.readRecords(_chunk.data.data() + _chunk.size, _chunk.data.size() - _chunk.size);
+            if (len == 0) {
+                eof = true;
+            }
+            _chunk.size += len;
+        }
+        if (record_size != 0) {
+            size_t whole = _chunk.size / record_size * record_size;
+            if (eof && whole != _chunk.size) {
+                // 文件大小不是记录大小的整数倍
+                this->_error = EINVAL;
+                return false;
+            }
+            _carry.assign(_chunk.data.data() + whole, _chunk.size - whole);
+            _chunk.size = whole;
+            break;
+        }
+        if (eof) {
+            break;
+        }
+        // 最后一个换行符之后的内容留给下一块
+        auto last = (const char*)memrchr(_chunk.data.data(), '\n', _chunk.size);
+        if (last != nullptr) {
+            size_t end = size_t(last - _chunk.data.data()) + 1;
+            _carry.assign(_chunk.data.data() + end, _chunk.size - end);
+            _chunk.size = end;
+            break;
+        }
+        // 一行比整块还长
+        _chunk.data.resize(_chunk.data.size() * 2);
+    }
+    if (record_size == 0) {
+        // 行数超过上限时从第 _max_items 行之后截断，剩余部分放在 _carry 前面
+        const char* data = _chunk.data.data();
+        size_t pos = 0;
+        for (size_t count = 0; count < _max_items && pos < _chunk.size; ++count) {
+            auto newline = (const char*)std::memchr(data + pos, '\n', _chunk.size - pos);
+            pos = newline != nullptr ? size_t(newline - data) + 1 : _chunk.size;
+        }
+        if (pos < _chunk.size) {
+            _carry.insert(0, data + pos, _chunk.size - pos);
+            _chunk.size = pos;
+        }
+    }
+    this->parseChunk(_chunk);
+    return _chunk.size > 0;
+}
+
+void FileSorter::parseChunk(Chunk& _chunk) const
+{
+    _chunk.items.clear();
+    const char* data = _chunk.data.data();
+    size_t record_size = this->_options.record_size;
+    if (record_size != 0) {
+        _chunk.items.reserve(_chunk.size / record_size);
+        for (size_t pos = 0; pos < _chunk.size; pos += record_size) {
+            _chunk.items.push_back(this->makeItem(data + pos, record_size));
+        }
+        return;
+    }
+    size_t count = 0;
+    LineMapper::forEachLine(data, _chunk.size, [&](const LineView&) {
+        ++count;
+    });
+    _chunk.items.reserve(count);
+    LineMapper::forEachLine(data, _chunk.size, [&](const LineView& _line) {
+        _chunk.items.push_back(this->makeItem(_line.data, _line.size));
+    });
+}
+
+FileSorter::Item FileSorter::makeItem(const char* _data, size_t _size) const
+{
+    Item item {_data, _size, _data, _size};
+    if (this->_options.key) {
+        LineView key = this->_options.key(LineView{_data, _size});
+        item.key = key.data;
+        item.key_size = key.size;
+    }
+    return item;
+}
+
+bool FileSorter::keyLess(const char* _a, size_t _a_size, const char* _b, size_t _b_size) const
+{
+    if (this->_options.less) {
+        return this->_options.less(LineView{_a, _a_size}, LineView{_b, _b_size});
+    }
+    int ret = std::memcmp(_a, _b, std::min(_a_size, _b_size));
+    return ret < 0 || (ret == 0 && _a_size < _b_size);
+}
+
+bool FileSorter::itemLess(const Item& _a, const Item& _b) const
+{
+    return this->keyLess(_a.key, _a.key_size, _b.key, _b.key_size);
+}
+
+void FileSorter::sortChunk(Chunk& _chunk) const
+{
+    auto& items = _chunk.items;
+    auto less = [this](const Item& _a, const Item& _b) {
+        return this->itemLess(_a, _b);
+    };
+    size_t parts = std::min(size_t(this->threadCount()), items.size() / kMinItemsPerThread + 1);
+    if (parts <= 1) {
+        std::stable_sort(items.begin(), items.end(), less);
+        return;
+    }
+    // 每个线程排序一段，再两两合并
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= parts; ++i) {
+        bounds.push_back(items.size() * i / parts);
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < parts; ++i) {
+        threads.emplace_back([&, i]() {
+            std::stable_sort(items.begin() + bounds[i], items.begin() + bounds[i + 1], less);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged;
+        threads.clear();
+        for (size_t i = 0; i + 2 < bounds.size(); i += 2) {
+            threads.emplace_back([&, i]() {
+                std::inplace_merge(items.begin() + bounds[i], items.begin() + bounds[i + 1],
+                                   items.begin() + bounds[i + 2], less);
+            });
+            merged.push_back(bounds[i]);
+        }
+        if (bounds.size() % 2 == 0) {
+            // 奇数段时最后一段留到下一轮
+            merged.push_back(bounds[bounds.size() - 2]);
+        }
+        merged.push_back(bounds.back());
+        for (auto& t : threads) {
+            t.join();
+        }
+        bounds.swap(merged);
+    }
+}
+
+bool FileSorter::writeChunk(const Chunk& _chunk, FileWriter& _writer) const
+{
+    bool lines = this->_options.record_size == 0;
+    for (auto& item : _chunk.items) {
+        _writer.write(item.data, item.size);
+        if (lines) {
+            _writer.write("\n", 1);
+        }
+    }
+    return bool(_writer);
+}
+
+bool FileSorter::spillChunk(Chunk& _chunk, const std::string& _path)
+{
+    this->sortChunk(_chunk);
+    FileWriter writer(File::createIfNotExist(_path, 0600), this->_options.buffer_size);
+    if (!writer) {
+        this->_error = writer.file()._error;
+        return false;
+    }
+    bool ok = this->writeChunk(_chunk, writer);
+    writer.flush();
+    if (!ok || writer.pending() != 0) {
+        this->_error = EIO;
+        return false;
+    }
+    return true;
+}
+
+void FileSorter::reduceRuns(std::vector<std::string>& _runs)
+{
+    size_t fan_in = mergeFanIn();
+    while (this->_error == 0 && _runs.size() > fan_in) {
+        // 相邻的有序段按顺序分组归并，保持排序稳定
+        std::vector<std::string> merged;
+        size_t i = 0;
+        while (this->_error == 0 && i < _runs.size()) {
+            size_t end = std::min(i + fan_in, _runs.size());
+            if (end - i == 1) {
+                merged.push_back(_runs[i++]);
+                continue;
+            }
+            std::vector<std::string> group(_runs.begin() + i, _runs.begin() + end);
+            merged.push_back(tempRunPath(this->_options.temp_dir));
+            FileWriter writer(File::createIfNotExist(merged.back(), 0600), this->_options.buffer_size);
+            if (!writer) {
+                this->_error = writer.file()._error != 0 ? writer.file()._error : EIO;
+            } else if (this->mergeRuns(group, writer)) {
+                writer.flush();
+                if (writer.pending() != 0) {
+                    this->_error = writer.error() != 0 ? writer.error() : EIO;
+                }
+            }
+            for (auto& run : group) {
+                ::unlink(run.c_str());
+            }
+            i = end;
+        }
+        // 出错时没有处理的有序段留给调用者删除
+        merged.insert(merged.end(), _runs.begin() + i, _runs.end());
+        _runs.swap(merged);
+    }
+}
+
+bool FileSorter::mergeRuns(const std::vector<std::string>& _runs, FileWriter& _writer)
+{
+    // 归并时内存平均分给每个输入
+    size_t buffer_size = std::max(kMinMergeBuffer,
+                                  std::min(this->_options.buffer_size, this->_options.memory_budget / (_runs.size() + 1)));
+    size_t record_size = this->_options.record_size;
+    std::vector<std::unique_ptr<RunReader>> readers;
+    std::vector<Item> heads(_runs.size());
+    std::vector<bool> done(_runs.size(), false);
+    for (size_t i = 0; i < _runs.size(); ++i) {
+        readers.emplace_back(new RunReader(_runs[i], buffer_size, record_size));
+        if (!*readers.back()) {
+            int error = readers.back()->file()._error;
+            this->_error = error != 0 ? error : EIO;
+            return false;
+        }
+        if (readers[i]->next()) {
+            heads[i] = this->makeItem(readers[i]->current().data, readers[i]->current().size);
+        } else {
+            done[i] = true;
+        }
+    }
+
+    // 键相同时序号小的输入胜出，保证排序稳定
+    auto tree = makeLoserTree(_runs.size(), [&](int _a, int _b) -> bool {
+        if (_a < 0 || _b < 0) {
+            return _a < 0;
+        }
+        if (done[_a] || done[_b]) {
+            return !done[_a];
+        }
+        if (this->itemLess(heads[_a], heads[_b])) {
+            return true;
+        }
+        if (this->itemLess(heads[_b], heads[_a])) {
+            return false;
+        }
+        return _a < _b;
+    });
+
+    while (true) {
+        int winner = tree.top();
+        if (winner < 0 || done[winner]) {
+            break;
+        }
+        _writer.write(heads[winner].data, heads[winner].size);
+        if (record_size == 0) {
+            _writer.write("\n", 1);
+        }
+        auto& reader = *readers[winner];
+        if (reader.next()) {
+            heads[winner] = this->makeItem(reader.current().data, reader.current().size);
+        } else {
+            done[winner] = true;
+        }
+        tree.adjust(winner);
+    }
+    if (!_writer) {
+        this->_error = EIO;
+        return false;
+    }
+    return true;
+}
@@ -9,13 +9,242 @@
 **/
 
 #include "file_tool.h"
+#include "file_copy.h"
+#include "checksum.h"
+#include "arena.h"
+#include <climits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    template<typename Tp>
+    void swapBytesScalar(Tp* _data, size_t _count)
+    {
+        for (size_t i = 0; i < _count; ++i) {
+            switch (sizeof(Tp)) {
+                case 2: _data[i] = Tp(__builtin_bswap16(uint16_t(_data[i]))); break;
+                case 4: _data[i] = Tp(__builtin_bswap32(uint32_t(_data[i]))); break;
+                default: _data[i] = Tp(__builtin_bswap64(uint64_t(_data[i]))); break;
+            }
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // 每次用 pshufb 转换 16 字节，返回处理的元素数量
+    __attribute__((target("ssse3")))
+    size_t swapBytesSsse3(File::byte* _data, size_t _elem_size, size_t _count)
+    {
+        __m128i mask;
+        switch (_elem_size) {
+            case 2:
+                mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+                break;
+            case 4:
+                mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+                break;
+            default:
+                mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+                break;
+        }
+        size_t bytes = _elem_size * _count;
+        size_t i = 0;
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(_data + i));
+            _mm_storeu_si128((__m128i*)(_data + i), _mm_shuffle_epi8(v, mask));
+        }
+        return i / _elem_size;
+    }
+
+    // 每次检查 128 字节，返回确认全为 0 的字节数，遇到非 0 数据返回 -1
+    __attribute__((target("avx2")))
+    ssize_t zeroPrefixAvx2(const File::byte* _data, size_t _size)
+    {
+        size_t i = 0;
+        for (; i + 128 <= _size; i += 128) {
+            auto p = (const __m256i*)(_data + i);
+            __m256i acc = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+                                          _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+            if (!_mm256_testz_si256(acc, acc)) {
+                return -1;
+            }
+        }
+        return ssize_t(i);
+    }
+
+    // SSE2 在 x86_64 上总是可用
+    __attribute__((target("sse2")))
+    ssize_t zeroPrefixSse2(const File::byte* _data, size_t _size)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 64 <= _size; i += 64) {
+            auto p = (const __m128i*)(_data + i);
+            __m128i acc = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                                       _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) {
+                return -1;
+            }
+        }
+        return ssize_t(i);
+    }
+#endif
+
+    // 拼接 [_start, _end) 中的一段，相邻的同类区域合并
+    void appendExtent(std::vector<File::Extent>& _extents, off64_t _start, off64_t _end, bool _hole, bool _with_holes)
+    {
+        if (_end <= _start || (_hole && !_with_holes)) {
+            return;
+        }
+        if (!_extents.empty()) {
+            auto& last = _extents.back();
+            if (last.hole == _hole && last.offset + off64_t(last.length) == _start) {
+                last.length += size_t(_end - _start);
+                return;
+            }
+        }
+        _extents.push_back({_start, size_t(_end - _start), _hole});
+    }
+}
+
+bool isAllZero(const void* _data, size_t _size)
+{
+    auto data = (const File::byte*)_data;
+    size_t done = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    static const bool has_sse2 = __builtin_cpu_supports("sse2");
+    ssize_t len = 0;
+    if (has_avx2) {
+        len = zeroPrefixAvx2(data, _size);
+    } else if (has_sse2) {
+        len = zeroPrefixSse2(data, _size);
+    }
+    if (len < 0) {
+        return false;
+    }
+    done = size_t(len);
+#endif
+    // 剩余部分按 8 字节检查
+    uint64_t acc = 0;
+    for (; done + 8 <= _size; done += 8) {
+        uint64_t v;
+        std::memcpy(&v, data + done, 8);
+        acc |= v;
+    }
+    for (; done < _size; ++done) {
+        acc |= data[done];
+    }
+    return acc == 0;
+}
+
+void swapBytes(void* _data, size_t _elem_size, size_t _count)
+{
+    if (_elem_size != 2 && _elem_size != 4 && _elem_size != 8) {
+        return;
+    }
+    auto data = (File::byte*)_data;
+    size_t done = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3) {
+        done = swapBytesSsse3(data, _elem_size, _count);
+    }
+#endif
+    data += done * _elem_size;
+    switch (_elem_size) {
+        case 2: swapBytesScalar((uint16_t*)data, _count - done); break;
+        case 4: swapBytesScalar((uint32_t*)data, _count - done); break;
+        default: swapBytesScalar((uint64_t*)data, _count - done); break;
+    }
+}
+
+FileStat FileStat::of(int _dir_fd, const char* _path, unsigned _mask, int _flags)
+{
+    FileStat st;
+    struct statx stx {};
+    if (::statx(_dir_fd, _path, _flags, _mask, &stx) == 0) {
+        st._mask = stx.stx_mask;
+        st._mode = stx.stx_mode;
+        st._uid = stx.stx_uid;
+        st._gid = stx.stx_gid;
+        st._nlink = stx.stx_nlink;
+        st._ino = stx.stx_ino;
+        st._size = off64_t(stx.stx_size);
+        st._blocks = blkcnt64_t(stx.stx_blocks);
+        st._block_size = blksize_t(stx.stx_blksize);
+        st._atime = {stx.stx_atime.tv_sec, stx.stx_atime.tv_nsec};
+        st._mtime = {stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec};
+        st._ctime = {stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec};
+        return st;
+    }
+    if (errno != ENOSYS) {
+        st._error = errno;
+        return st;
+    }
+    // 内核不支持 statx，退回 fstatat
+    struct stat64 s {};
+    if (::fstatat64(_dir_fd, _path, &s, _flags) != 0) {
+        st._error = errno;
+        return st;
+    }
+    st._mask = kAll;
+    st._mode = s.st_mode;
+    st._uid = s.st_uid;
+    st._gid = s.st_gid;
+    st._nlink = s.st_nlink;
+    st._ino = s.st_ino;
+    st._size = s.st_size;
+    st._blocks = s.st_blocks;
+    st._block_size = s.st_blksize;
+    st._atime = s.st_atim;
+    st._mtime = s.st_mtim;
+    st._ctime = s.st_ctim;
+    return st;
+}
+
+std::vector<FileStat> FileStat::batch(int _dir_fd, const std::vector<std::string>& _names, unsigned _mask, int _flags)
+{
+    std::vector<FileStat> stats;
+    stats.reserve(_names.size());
+    for (auto& name : _names) {
+        stats.push_back(FileStat::of(_dir_fd, name.data(), _mask, _flags));
+    }
+    return stats;
+}
+
+FileStat File::stat(unsigned _mask) const
+{
+    std::lock_guard<std::mutex> guard(this->_stat_lock);
+    unsigned valid = this->_stat_mask.load();
+    if ((valid & kStatStale) != 0 || (valid & _mask) != _mask) {
+        this->refreshStatLocked((valid & kStatStale) != 0 ? _mask : (valid | _mask));
+    }
+    return this->_stat;
+}
+
+FileStat File::refreshStat(unsigned _mask) const
+{
+    std::lock_guard<std::mutex> guard(this->_stat_lock);
+    this->refreshStatLocked(_mask);
+    return this->_stat;
+}
+
+void File::refreshStatLocked(unsigned _mask) const
+{
+    // 先清除标记再获取，期间其他线程写入时标记重新出现，这次的结果不会被当作有效
+    this->_stat_mask.store(0);
+    this->_stat = FileStat::of(this->_fd, _mask);
+    unsigned expected = 0;
+    this->_stat_mask.compare_exchange_strong(expected, this->_stat ? _mask : 0);
+}
 
 bool File::_open(int _flags, int _mode) {
-    // 设置默认打开模式
-    _flags |= kDefaultOpenFlags;
-    if ((_flags & kReadOnly) && (_flags & kWriteOnly)) {
-        _flags &= ~kWriteOnly;
-        _flags &= ~kReadWrite;
+    // 访问方式按调用者指定的打开，kReadOnly 为 0，不能再加上默认的读写，否则只读文件无法打开
+    // kWriteOnly | kReadWrite 不是合法的访问方式，按读写打开
+    if ((_flags & O_ACCMODE) == O_ACCMODE) {
+        _flags = (_flags & ~O_ACCMODE) | kReadWrite;
     }
     // append 和 trunc 同在是保留 trunc
     if ((_flags & kAppend) && (_flags & kTrunc)) {
@@ -28,6 +257,15 @@ bool File::_open(int _flags, int _mode) {
     } else {
         fd = ::open(this->_file_name.data(), _flags, _mode);
     }
+    // tmpfs 等文件系统不支持 O_DIRECT，去掉后重新打开
+    if (fd < 0 && errno == EINVAL && (_flags & kDirect)) {
+        _flags &= ~kDirect;
+        if (_mode == -1) {
+            fd = ::open(this->_file_name.data(), _flags);
+        } else {
+            fd = ::open(this->_file_name.data(), _flags, _mode);
+        }
+    }
     if (fd < 0) {
         this->_error = errno;
         return false;
@@ -37,26 +275,52 @@ bool File::_open(int _flags, int _mode) {
     return true;
 }
 
+namespace
+{
+    // 创建 _path[0, _end) 目录，父目录不存在时先递归创建父目录
+    // 从最深的目录开始尝试，父目录已存在时只需要一次 mkdir
+    bool makeDirs(std::string& _path, std::string::size_type _end, int _dir_mode)
+    {
+        while (_end > 1 && _path[_end - 1] == '/') {
+            --_end;
+        }
+        if (_end == 0 || (_end == 1 && _path[0] == '/')) {
+            return true;
+        }
+        char saved = _path[_end];
+        _path[_end] = '\0';
+        int res = ::mkdir(_path.data(), _dir_mode);
+        if (res != 0 && errno == ENOENT) {
+            auto index = _path.find_last_of('/', _end - 1);
+            if (index != std::string::npos && makeDirs(_path, index, _dir_mode)) {
+                res = ::mkdir(_path.data(), _dir_mode);
+            }
+        }
+        bool ok = (res == 0 || errno == EEXIST);
+        if (!ok) {
+            fprintf(stderr, "mkdir dir[%s] error!\n", _path.data());
+        }
+        _path[_end] = saved;
+        return ok;
+    }
+
+    // 创建文件所在的所有父目录，目录权限受 umask 影响
+    bool makeParentDirs(const std::string& _path, int _dir_mode)
+    {
+        auto index = _path.find_last_of('/');
+        if (index == std::string::npos) {
+            return true;
+        }
+        std::string path = _path;
+        return makeDirs(path, index, _dir_mode == 0 ? 0777 : _dir_mode);
+    }
+}
+
 // 按文件权限和目录权限创建文件
 File File::create(const std::string &_path, int _file_mode, bool _is_recursion, int _dir_mode)
 {
     if (_is_recursion) {
-        std::string::size_type index, start = 0;
-        std::string tmp;
-        mode_t u_mask = 0;
-        if (_dir_mode == 0) {
-            u_mask = umask(0);
-            _dir_mode = 0777;
-        }
-        while ((index = _path.find_first_of('/', start)) != std::string::npos) {
-            tmp = _path.substr(0, index + 1);
-            if (!File::isExist(tmp.data())) {
-                if (mkdir(tmp.data(), _dir_mode & (~u_mask)) != 0) {
-                    fprintf(stderr, "mkdir dir[%s] error!\n", tmp.data());
-                }
-            }
-            start = index + 1;
-        }
+        makeParentDirs(_path, _dir_mode);
     }
     return File(_path, (kCreateForce | kDefaultOpenFlags), _file_mode);
 }
@@ -64,42 +328,164 @@ File File::create(const std::string &_path, int _file_mode, bool _is_recursion,
 File File::createIfNotExist(const std::string &_path, int _file_mode, bool _is_recursion, int _dir_mode)
 {
     if (_is_recursion) {
-        std::string::size_type index, start = 0;
-        std::string tmp;
-        mode_t u_mask = 0;
-        if (_dir_mode == 0) {
-            u_mask = umask(0);
-            _dir_mode = 0777;
-        }
-        while ((index = _path.find_first_of('/', start)) != std::string::npos) {
-            tmp = _path.substr(0, index + 1);
-            if (!File::isExist(tmp.data())) {
-                if (mkdir(tmp.data(), _dir_mode & (~u_mask)) != 0) {
-                    fprintf(stderr, "mkdir dir[%s] error!\n", tmp.data());
-                }
-            }
-            start = index + 1;
-        }
+        makeParentDirs(_path, _dir_mode);
     }
     return File(_path, (kCreateNotExist | kDefaultOpenFlags), _file_mode);
 }
 
+bool File::createDirs(const std::string& _dir, int _dir_mode)
+{
+    std::string path = _dir;
+    return makeDirs(path, path.size(), _dir_mode == 0 ? 0777 : _dir_mode);
+}
+
 File File::open(const std::string& _path, int _flags) {
     return File(_path, _flags);
 }
 
 
 
+std::vector<File::Extent> File::extents(off64_t _start, off64_t _end) const
+{
+    return File::seekExtents(this->_fd, _start, _end < 0 ? this->size() : _end, true);
+}
+
+std::vector<File::Extent> File::dataExtents(off64_t _start, off64_t _end) const
+{
+    return File::seekExtents(this->_fd, _start, _end < 0 ? this->size() : _end, false);
+}
+
+std::vector<File::Extent> File::seekExtents(int _fd, off64_t _start, off64_t _end, bool _with_holes)
+{
+    std::vector<Extent> extents;
+    if (_fd < 0 || _end <= _start) {
+        return extents;
+    }
+    // SEEK_DATA 和 SEEK_HOLE 会移动文件偏移，结束后需要恢复
+    auto seek = ::lseek64(_fd, 0, SEEK_CUR);
+    off64_t offset = _start;
+    while (offset < _end) {
+        off64_t data = ::lseek64(_fd, offset, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // 之后没有数据，剩余部分都是空洞
+                appendExtent(extents, offset, _end, true, _with_holes);
+            } else {
+                // 文件系统不支持，当作没有空洞
+                extents.clear();
+                appendExtent(extents, _start, _end, false, _with_holes);
+            }
+            break;
+        }
+        data = std::min(data, _end);
+        appendExtent(extents, offset, data, true, _with_holes);
+        if (data >= _end) {
+            break;
+        }
+        off64_t hole = ::lseek64(_fd, data, SEEK_HOLE);
+        if (hole < 0 || hole > _end) {
+            hole = _end;
+        }
+        appendExtent(extents, data, hole, false, _with_holes);
+        offset = hole;
+    }
+    ::lseek64(_fd, seek, SEEK_SET);
+    return extents;
+}
+
+bool File::punchHole(off64_t _offset, size_t _count) const
+{
+    if (this->_fd < 0 || _count == 0) {
+        return _count == 0;
+    }
+    this->invalidateStat();
+    int ret;
+    do {
+        ret = ::fallocate64(this->_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, _offset, off64_t(_count));
+    } while (ret != 0 && errno == EINTR);
+    this->invalidateStat();
+    return ret == 0;
+}
+
+size_t File::sparsify(size_t _block_size) const
+{
+    auto st = this->stat(FileStat::kSize | FileStat::kBlocks);
+    size_t block_size = _block_size != 0 ? _block_size : size_t(st.blockSize());
+    if (block_size == 0) {
+        block_size = 4096;
+    }
+    off64_t size = st.size();
+    // 缓冲区大小取块大小的整数倍
+    std::vector<byte> buf(std::max(block_size, (size_t(1) << 20) / block_size * block_size));
+    size_t punched = 0;
+    off64_t zero_start = -1, zero_end = -1;
+    auto punch = [&]() -> bool {
+        if (zero_start < 0) {
+            return true;
+        }
+        bool ok = this->punchHole(zero_start, size_t(zero_end - zero_start));
+        if (ok) {
+            punched += size_t(zero_end - zero_start);
+        }
+        zero_start = zero_end = -1;
+        return ok;
+    };
+
+    for (auto& extent : this->dataExtents(0, size)) {
+        // 从块边界开始检查，文件末尾不完整的块不处理
+        off64_t pos = extent.offset / off64_t(block_size) * off64_t(block_size);
+        off64_t end = extent.offset + off64_t(extent.length);
+        while (pos < end && pos + off64_t(block_size) <= size) {
+            size_t want = size_t(std::min(off64_t(buf.size()), end - pos));
+            size_t len = this->multiReadBytes(buf.data(), size_t(pos), want);
+            if (len < block_size) {
+                break;
+            }
+            for (size_t i = 0; i + block_size <= len; i += block_size) {
+                off64_t block = pos + off64_t(i);
+                if (!isAllZero(buf.data() + i, block_size)) {
+                    if (!punch()) {
+                        return punched;
+                    }
+                    continue;
+                }
+                if (zero_start < 0) {
+                    zero_start = block;
+                }
+                zero_end = block + off64_t(block_size);
+            }
+            pos += off64_t(len / block_size * block_size);
+        }
+        if (!punch()) {
+            return punched;
+        }
+    }
+    return punched;
+}
+
+namespace
+{
+    // readVec 读取至少这么多字节时才检查空洞，小的读取不值得多出的几次系统调用
+    const size_t kMinHoleProbe = size_t(1) << 20;
+
+    // 传输失败后是否值得重试，信号中断和暂时不可用之外的错误（ENOSPC、EIO 等）重试也不会成功
+    bool retryable(int _err)
+    {
+        return _err == EINTR || _err == EAGAIN;
+    }
+}
+
 size_t File::readBytes(bytePtr _buf, size_t _count) const
 {
     int retry_count = 0;
-    size_t total_read_len = 0, read_len;
+    size_t total_read_len = 0;
+    ssize_t read_len;
     while (retry_count < kMaxRetryCount && total_read_len < _count) {
         read_len = ::read(this->_fd, _buf + total_read_len, _count - total_read_len);
         if (read_len > 0) {
-            total_read_len += read_len;
+            total_read_len += size_t(read_len);
         }else {
-            if (read_len == 0) {
+            if (read_len == 0 || !retryable(errno)) {
                 break;
             }
             // 信号中断
@@ -113,14 +499,129 @@ size_t File::readBytes(bytePtr _buf, size_t _count) const
 
 size_t File::writeBytes(constBytePtr _content, size_t _count) const
 {
+    // 写入前后都标记过期：写入期间获取的旧大小不会被当作有效，写入完成后也会重新获取
+    this->invalidateStat();
     int retry_count = 0;
-    size_t total_read_len = 0, read_len;
+    size_t total_write_len = 0;
+    ssize_t write_len;
+    while (retry_count < kMaxRetryCount && total_write_len < _count) {
+        write_len = ::write(this->_fd, _content + total_write_len, _count - total_write_len);
+        if (write_len > 0) {
+            total_write_len += size_t(write_len);
+        }else {
+            if (write_len < 0 && !retryable(errno)) {
+                break;
+            }
+            // 信号中断
+            if (write_len == 0 || errno != EINTR) {
+                ++retry_count;
+            }
+        }
+    }
+    this->invalidateStat();
+    return total_write_len;
+}
+
+namespace
+{
+    // 反复调用 _op 直到传输完全部数据，部分传输时跳过已完成的块
+    // 只完成一部分的块单独传输剩余部分，不需要复制调用者的 iovec 数组
+    template<typename Op>
+    size_t transferVector(const struct iovec* _iov, int _count, bool _is_read, int _max_retry, Op _op)
+    {
+        size_t total = 0;
+        int index = 0;
+        size_t skip = 0;    // 当前块已经传输的字节数
+        int retry_count = 0;
+        while (index < _count && retry_count < _max_retry) {
+            ssize_t len;
+            if (skip > 0) {
+                struct iovec rest = {(File::bytePtr)_iov[index].iov_base + skip, _iov[index].iov_len - skip};
+                len = _op(&rest, 1, total);
+            } else {
+                len = _op(_iov + index, std::min(_count - index, IOV_MAX), total);
+            }
+            if (len > 0) {
+                total += size_t(len);
+                size_t left = size_t(len);
+                while (index < _count) {
+                    size_t remain = _iov[index].iov_len - skip;
+                    if (left < remain) {
+                        skip += left;
+                        break;
+                    }
+                    left -= remain;
+                    skip = 0;
+                    ++index;
+                }
+            } else if (len == 0) {
+                if (_is_read) {
+                    break;
+                }
+                ++retry_count;
+            } else if (!retryable(errno)) {
+                break;
+            } else if (errno != EINTR) {
+                ++retry_count;
+            }
+            // 跳过长度为 0 的块
+            while (index < _count && skip == 0 && _iov[index].iov_len == 0) {
+                ++index;
+            }
+        }
+        return total;
+    }
+}
+
+size_t File::readVector(const struct iovec* _iov, int _count) const
+{
+    return transferVector(_iov, _count, true, kMaxRetryCount, [this](const struct iovec* _v, int _n, size_t) {
+        return ::readv(this->_fd, _v, _n);
+    });
+}
+
+size_t File::writeVector(const struct iovec* _iov, int _count) const
+{
+    this->invalidateStat();
+    size_t len = transferVector(_iov, _count, false, kMaxRetryCount, [this](const struct iovec* _v, int _n, size_t) {
+        return ::writev(this->_fd, _v, _n);
+    });
+    this->invalidateStat();
+    return len;
+}
+
+size_t File::multiReadVector(const struct iovec* _iov, int _count, size_t _start) const
+{
+    return transferVector(_iov, _count, true, kMaxRetryCount, [&](const struct iovec* _v, int _n, size_t _done) {
+        return ::preadv64(this->_fd, _v, _n, off64_t(_start + _done));
+    });
+}
+
+size_t File::multiWriteVector(const struct iovec* _iov, int _count, size_t _start) const
+{
+    this->invalidateStat();
+    size_t len = transferVector(_iov, _count, false, kMaxRetryCount, [&](const struct iovec* _v, int _n, size_t _done) {
+        return ::pwritev64(this->_fd, _v, _n, off64_t(_start + _done));
+    });
+    this->invalidateStat();
+    return len;
+}
+
+// 使用 pread/pwrite，不修改文件偏移，可以在多个线程中同时调用
+size_t File::multiReadBytes(bytePtr _buf, size_t _start, size_t _count) const
+{
+    int retry_count = 0;
+    size_t total_read_len = 0;
+    ssize_t read_len;
     while (retry_count < kMaxRetryCount && total_read_len < _count) {
-        read_len = ::write(this->_fd, _content + total_read_len, _count - total_read_len);
+        read_len = ::pread64(this->_fd, _buf + total_read_len, _count - total_read_len,
+                             off64_t(_start + total_read_len));
         if (read_len > 0) {
             total_read_len += read_len;
         }else {
-            // 信号中断
+            if (read_len == 0 || !retryable(errno)) {
+                break;
+            }
             if (errno != EINTR) {
                 ++retry_count;
             }
@@ -129,116 +630,513 @@ size_t File::writeBytes(constBytePtr _content, size_t _count) const
     return total_read_len;
 }
 
-// 非多线程安全！！
-size_t File::multiReadBytes(bytePtr _buf, size_t _start, size_t _count) const
+size_t File::multiWriteBytes(constBytePtr _content, size_t _start, size_t _count) const
 {
-    auto seek = ::lseek64(this->_fd, 0, SEEK_CUR);
-    ::lseek64(this->_fd, off64_t(_start), SEEK_SET);
-    auto len = this->readBytes(_buf, _count);
-    ::lseek64(this->_fd, seek, SEEK_SET);
-    return len;
+    this->invalidateStat();
+    int retry_count = 0;
+    size_t total_write_len = 0;
+    ssize_t write_len;
+    while (retry_count < kMaxRetryCount && total_write_len < _count) {
+        write_len = ::pwrite64(this->_fd, _content + total_write_len, _count - total_write_len,
+                               off64_t(_start + total_write_len));
+        if (write_len > 0) {
+            total_write_len += write_len;
+        }else {
+            if (write_len < 0 && !retryable(errno)) {
+                break;
+            }
+            if (write_len == 0 || errno != EINTR) {
+                ++retry_count;
+            }
+        }
+    }
+    this->invalidateStat();
+    return total_write_len;
 }
 
-size_t File::multiWriteBytes(constBytePtr _content, size_t _start, size_t _count) const
+bool File::sameFile(const File& _other) const
 {
-    auto seek = ::lseek64(this->_fd, 0, SEEK_CUR);
-    ::lseek64(this->_fd, off64_t(_start), SEEK_SET);
-    auto len = this->writeBytes(_content, _count);
-    ::lseek64(this->_fd, seek, SEEK_SET);
-    return len;
+    struct stat64 st {}, other_st {};
+    if (this->_fd < 0 || _other._fd < 0 || ::fstat64(this->_fd, &st) != 0 || ::fstat64(_other._fd, &other_st) != 0) {
+        return false;
+    }
+    return st.st_dev == other_st.st_dev && st.st_ino == other_st.st_ino;
+}
+
+size_t File::copyTo(const File& _dst) const
+{
+    return FileCopier().copy(*this, _dst);
+}
+
+size_t File::copyTo(const std::string& _path, int _file_mode) const
+{
+    auto dst = File::create(_path, _file_mode);
+    if (!dst) {
+        return 0;
+    }
+    return FileCopier().copy(*this, dst);
+}
+
+void FileReader::setStreaming(size_t _ahead, size_t _behind)
+{
+    this->_stream_ahead = _ahead;
+    this->_stream_behind = _behind;
+    this->_stream_pending = 0;
+    if (_ahead == 0) {
+        ::posix_fadvise64(this->_file._fd, 0, 0, POSIX_FADV_NORMAL);
+        return;
+    }
+    // 顺序读取会让内核加倍预读窗口
+    ::posix_fadvise64(this->_file._fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    auto pos = ::lseek64(this->_file._fd, 0, SEEK_CUR);
+    this->_stream_dropped = 0;
+    ::readahead(this->_file._fd, pos, _ahead);
+}
+
+size_t FileReader::readBytes(File::bytePtr _buf, size_t _count) const
+{
+    size_t buffered = std::min(_count, this->_line_end - this->_line_pos);
+    if (buffered != 0) {
+        std::memcpy(_buf, this->_line_buf.data() + this->_line_pos, buffered);
+        this->_line_pos += buffered;
+        if (buffered == _count) {
+            return _count;
+        }
+    }
+    size_t len = this->_file.readBytes(_buf + buffered, _count - buffered);
+    this->advanceStream(len);
+    return buffered + len;
+}
+
+void FileReader::advanceStream(size_t _count) const
+{
+    if (this->_stream_ahead != 0) {
+        this->_stream_pending += _count;
+        // 每读取半个窗口调整一次，避免每次读取都多一次系统调用
+        if (this->_stream_pending >= this->_stream_ahead / 2) {
+            this->_stream_pending = 0;
+            this->adviseStream();
+        }
+    }
+}
+
+bool FileReader::fillLineBuffer() const
+{
+    if (this->_line_buf.empty()) {
+        this->_line_buf.resize(kLineBufferSize);
+    }
+    // 只读取一次，管道中不会等待缓冲区填满
+    ssize_t len;
+    do {
+        len = ::read(this->_file._fd, this->_line_buf.data(), this->_line_buf.size());
+    } while (len < 0 && errno == EINTR);
+    this->_line_pos = 0;
+    this->_line_end = len > 0 ? size_t(len) : 0;
+    this->advanceStream(this->_line_end);
+    return this->_line_end != 0;
+}
+
+void FileReader::unbuffer() const
+{
+    if (this->_line_pos < this->_line_end) {
+        ::lseek64(this->_file._fd, -off64_t(this->_line_end - this->_line_pos), SEEK_CUR);
+    }
+    this->_line_pos = 0;
+    this->_line_end = 0;
+}
+
+void FileReader::adviseStream() const
+{
+    int fd = this->_file._fd;
+    auto pos = ::lseek64(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        return;
+    }
+    ::readahead(fd, pos, this->_stream_ahead);
+    // 丢弃已经读过的内容，保留读取位置之前 _stream_behind 字节
+    static const off64_t page_size = ::sysconf(_SC_PAGESIZE);
+    off64_t drop_end = (pos - off64_t(this->_stream_behind)) / page_size * page_size;
+    if (drop_end > this->_stream_dropped) {
+        ::posix_fadvise64(fd, this->_stream_dropped, drop_end - this->_stream_dropped, POSIX_FADV_DONTNEED);
+        this->_stream_dropped = drop_end;
+    }
+}
+
+size_t FileReader::readRecordBytes(void* _records, size_t _record_size, size_t _count) const
+{
+    size_t bytes = this->readBytes((File::bytePtr)_records, _record_size * _count);
+    size_t partial = bytes % _record_size;
+    if (partial != 0) {
+        ::lseek64(this->_file._fd, -off64_t(partial), SEEK_CUR);
+    }
+    return bytes / _record_size;
 }
 
 auto FileReader::readString() const -> std::string
 {
-    return this->readString(this->_file.size());
+    return this->readString(size_t(this->_file.refreshStat(FileStat::kSize).size()));
 }
 
 auto FileReader::readVec() const -> std::vector<File::byte>
 {
-    return this->readVec(this->_file.size());
+    return this->readVec(size_t(this->_file.refreshStat(FileStat::kSize).size()));
 }
 
 auto FileReader::readStringLine() const -> std::string
 {
-    File::byte buf[32];
-    size_t read_len = 1;
     std::string content;
-    content.reserve(32);
-    while (read_len != 0) {
-        read_len = this->_file.readBytes(buf, 32);
-        for (int i = 0; i < read_len; ++i) {
-            if (buf[i] != '\n') {
-                content.push_back((char)buf[i]);
-            }else {
-                ::lseek64(this->_file._fd, -(31 - i), SEEK_CUR);
-                return content;
-            }
-        }
-    }
+    this->readLine(content);
     return content;
 }
 
 auto FileReader::readVecLine() const -> std::vector<File::byte>
 {
-    File::byte buf[32];
-    size_t read_len = 1;
     std::vector<File::byte> content;
-    content.resize(32);
-    while (read_len != 0) {
-        read_len = this->_file.readBytes(buf, 32);
-        for (int i = 0; i < 32; ++i) {
-            if (buf[i] != '\n') {
-                content.push_back((char)buf[i]);
-            }else {
-                ::lseek64(this->_file._fd, -(31 - i), SEEK_CUR);
-                return content;
-            }
-        }
-    }
+    this->readLine(content);
     return content;
 }
 
 auto FileReader::readString(size_t _len) const -> std::string
 {
-    char buf[128];
-    size_t read_len = 1, total_read_len = 0;
     std::string content;
-    content.reserve(_len);
-    while (read_len != 0) {
-        read_len = this->_file.readBytes((File::bytePtr)buf, std::min((size_t)128, (_len - total_read_len)));
-        content += buf;
-    }
+    this->readString(content, _len);
     return content;
 }
 
 auto FileReader::readVec(size_t _len) const -> std::vector<File::byte>
 {
-    size_t read_len = 1, total_read_len = 0;
     std::vector<File::byte> content;
-    content.resize(_len);
-    while (read_len != 0) {
-        read_len = this->_file.readBytes(File::bytePtr(content.data() + total_read_len), _len - total_read_len);
+    this->readVec(content, _len);
+    return content;
+}
+
+size_t FileReader::read(void* _buf, size_t _count) const
+{
+    return this->readBytes((File::bytePtr)_buf, _count);
+}
+
+size_t FileReader::readString(std::string& _content, size_t _len) const
+{
+    _content.resize(_len);
+    size_t read_len = 1, total_read_len = 0;
+    while (read_len != 0 && total_read_len < _len) {
+        read_len = this->readBytes((File::bytePtr)&_content[total_read_len], _len - total_read_len);
         total_read_len += read_len;
     }
-    return content;
+    _content.resize(total_read_len);
+    return total_read_len;
+}
+
+size_t FileReader::readVec(std::vector<File::byte>& _content, size_t _len) const
+{
+    // 大的读取遇到普通文件中有空洞时只读取数据部分，其余保持为 0，小的读取直接读
+    // 缓存的大小可能已经过期，重新获取，避免按旧的文件尾截断
+    if (_len >= kMinHoleProbe && this->_file.refreshStat(FileStat::kType | FileStat::kSize).isRegularFile()) {
+        this->unbuffer();
+        auto pos = ::lseek64(this->_file._fd, 0, SEEK_CUR);
+        off64_t end = std::min(pos + off64_t(_len), off64_t(this->_file.size()));
+        if (pos >= 0 && end > pos) {
+            auto extents = this->_file.dataExtents(pos, end);
+            bool has_hole = extents.size() != 1 || extents[0].offset != pos || extents[0].length != size_t(end - pos);
+            if (has_hole) {
+                _content.assign(size_t(end - pos), 0);
+                for (auto& extent : extents) {
+                    size_t got = this->_file.multiReadBytes(_content.data() + (extent.offset - pos), size_t(extent.offset), extent.length);
+                    if (got < extent.length) {
+                        // 读取期间文件变短，停在实际读到的文件尾
+                        _content.resize(size_t(extent.offset - pos) + got);
+                        break;
+                    }
+                }
+                ::lseek64(this->_file._fd, pos + off64_t(_content.size()), SEEK_SET);
+                return _content.size();
+            }
+        }
+    }
+    _content.resize(_len);
+    size_t read_len = 1, total_read_len = 0;
+    while (read_len != 0 && total_read_len < _len) {
+        read_len = this->readBytes(_content.data() + total_read_len, _len - total_read_len);
+        total_read_len += read_len;
+    }
+    _content.resize(total_read_len);
+    return total_read_len;
+}
+
+namespace
+{
+    // 追加时不经过临时对象，容量足够时不分配内存
+    void appendBytes(std::string& _line, const File::byte* _start, const File::byte* _end)
+    {
+        _line.append((const char*)_start, size_t(_end - _start));
+    }
+
+    void appendBytes(std::vector<File::byte>& _line, const File::byte* _start, const File::byte* _end)
+    {
+        _line.insert(_line.end(), _start, _end);
+    }
+}
+
+template<typename Container>
+bool FileReader::readLineTo(Container& _line) const
+{
+    _line.clear();
+    bool got = false;
+    while (this->_line_pos < this->_line_end || this->fillLineBuffer()) {
+        got = true;
+        const File::byte* start = this->_line_buf.data() + this->_line_pos;
+        const File::byte* end = this->_line_buf.data() + this->_line_end;
+        auto newline = (const File::byte*)std::memchr(start, '\n', size_t(end - start));
+        if (newline != nullptr) {
+            appendBytes(_line, start, newline);
+            this->_line_pos = size_t(newline - this->_line_buf.data()) + 1;
+            return true;
+        }
+        appendBytes(_line, start, end);
+        this->_line_pos = this->_line_end;
+    }
+    return got;
+}
+
+bool FileReader::readLine(std::string& _line) const
+{
+    return this->readLineTo(_line);
+}
+
+bool FileReader::readLine(std::vector<File::byte>& _line) const
+{
+    return this->readLineTo(_line);
+}
+
+bool FileReader::readLine(Arena& _arena, LineView& _line) const
+{
+    // 整行都在缓冲区中时直接拷贝到 _arena
+    if (this->_line_pos < this->_line_end) {
+        auto start = this->_line_buf.data() + this->_line_pos;
+        auto newline = (const File::byte*)std::memchr(start, '\n', this->_line_end - this->_line_pos);
+        if (newline != nullptr) {
+            size_t size = size_t(newline - start);
+            _line = LineView {_arena.copy(start, size), size};
+            this->_line_pos += size + 1;
+            return true;
+        }
+    }
+    if (!this->readLineTo(this->_line_scratch)) {
+        return false;
+    }
+    _line = LineView {_arena.copy(this->_line_scratch.data(), this->_line_scratch.size()), this->_line_scratch.size()};
+    return true;
 }
 
 size_t FileWriter::write(const std::string &_content)
 {
-    return this->write(_content, _content.size());
+    return this->write(_content.data(), _content.size());
 }
 
 size_t FileWriter::write(const std::string &_content, size_t _count)
 {
-    return this->_file.writeBytes((File::constBytePtr)(_content.data()), _count);
+    return this->write(_content.data(), std::min(_count, _content.size()));
 }
 
 size_t FileWriter::write(const std::vector<File::byte> &_content)
 {
-    return this->write(_content, _content.size());
+    return this->write(_content.data(), _content.size());
 }
 
 size_t FileWriter::write(const std::vector<File::byte> &_content, size_t _count)
 {
-    return this->_file.writeBytes((File::constBytePtr)(_content.data()), _count);
+    return this->write(_content.data(), std::min(_count, _content.size()));
+}
+
+size_t FileWriter::write(const void* _content, size_t _count)
+{
+    if (this->_error != 0) {
+        // 之前的写入已经失败，不再接受新数据，避免文件内容缺失一段
+        return 0;
+    }
+    auto data = (File::constBytePtr)(_content);
+    // 大块数据直接写入，不经过缓冲区拷贝，缓冲区还有内容时一起用 writev 写出，保证顺序
+    if (_count >= this->_buf_size && !this->_buf.empty()) {
+        struct iovec iov = {const_cast<File::bytePtr>(data), _count};
+        return this->write(&iov, 1);
+    }
+    if (_count >= this->_buf_size) {
+        size_t len = this->writeBytes(data, _count);
+        if (this->_checksum != nullptr) {
+            this->_checksum->update(data, len);
+        }
+        return len;
+    }
+    // 缓冲区放不下时先写出已有内容，没有全部写出说明写入失败
+    if (!this->_buf.empty() && this->_buf.size() + _count > this->_buf_size) {
+        this->flush();
+        if (!this->_buf.empty()) {
+            return 0;
+        }
+    }
+    if (this->_buf.capacity() < this->_buf_size) {
+        this->_buf.reserve(this->_buf_size);
+    }
+    this->_buf.insert(this->_buf.end(), data, data + _count);
+    if (this->_checksum != nullptr) {
+        this->_checksum->update(data, _count);
+    }
+    return _count;
+}
+
+size_t FileWriter::write(const struct iovec* _iov, int _count)
+{
+    if (this->_error != 0) {
+        return 0;
+    }
+    size_t total = 0;
+    for (int i = 0; i < _count; ++i) {
+        total += _iov[i].iov_len;
+    }
+    // 能放进缓冲区时和普通小块写入一样处理
+    if (total < this->_buf_size && this->_buf.size() + total <= this->_buf_size) {
+        for (int i = 0; i < _count; ++i) {
+            this->write(_iov[i].iov_base, _iov[i].iov_len);
+        }
+        return total;
+    }
+
+    // 缓冲区中的内容放在最前面，和调用者的数据一起写出
+    struct iovec small[16];
+    std::vector<struct iovec> large;
+    struct iovec* iov = small;
+    int count = _count + (this->_buf.empty() ? 0 : 1);
+    if (count > int(sizeof(small) / sizeof(small[0]))) {
+        large.resize(size_t(count));
+        iov = large.data();
+    }
+    int n = 0;
+    if (!this->_buf.empty()) {
+        iov[n++] = {this->_buf.data(), this->_buf.size()};
+    }
+    std::copy(_iov, _iov + _count, iov + n);
+
+    errno = 0;
+    size_t len = this->_file.writeVector(iov, count);
+    this->advanceStream(len);
+    size_t buffered = this->_buf.size();
+    if (len < buffered + total) {
+        this->setError();
+    }
+    if (len < buffered) {
+        // 缓冲区都没有写完，未写出的部分留在缓冲区
+        this->_buf.erase(this->_buf.begin(), this->_buf.begin() + len);
+        return 0;
+    }
+    this->_buf.clear();
+    size_t written = len - buffered;
+    if (this->_checksum != nullptr) {
+        size_t left = written;
+        for (int i = 0; i < _count && left > 0; ++i) {
+            size_t part = std::min(left, _iov[i].iov_len);
+            this->_checksum->update(_iov[i].iov_base, part);
+            left -= part;
+        }
+    }
+    return written;
+}
+
+size_t FileWriter::writeSwapped(const void* _records, size_t _record_size, size_t _count)
+{
+    // 转换到栈上的小块内存中，不修改调用者数据，也不需要分配内存
+    File::byte chunk[8192];
+    const size_t chunk_count = sizeof(chunk) / _record_size;
+    auto data = (const File::byte*)_records;
+    size_t total = 0;
+    while (total < _count) {
+        size_t count = std::min(chunk_count, _count - total);
+        std::memcpy(chunk, data + total * _record_size, count * _record_size);
+        swapBytes(chunk, _record_size, count);
+        size_t len = this->write(chunk, count * _record_size);
+        total += len / _record_size;
+        if (len != count * _record_size) {
+            break;
+        }
+    }
+    return total;
+}
+
+void FileWriter::setStreaming(size_t _window)
+{
+    this->flush();
+    static const size_t page_size = size_t(::sysconf(_SC_PAGESIZE));
+    this->_stream_window = (_window + page_size - 1) / page_size * page_size;
+    this->_stream_offset = ::lseek64(this->_file._fd, 0, SEEK_CUR);
+    this->_stream_start = -1;
+    if (this->_stream_offset < 0) {
+        this->_stream_window = 0;
+        return;
+    }
+    // 窗口从页边界开始
+    this->_stream_start = this->_stream_offset / off64_t(page_size) * off64_t(page_size);
+}
+
+size_t FileWriter::writeBytes(File::constBytePtr _content, size_t _count)
+{
+    errno = 0;
+    size_t len = std::min(this->_file.writeBytes(_content, _count), _count);
+    this->advanceStream(len);
+    if (len < _count) {
+        this->setError();
+    }
+    return len;
+}
+
+void FileWriter::setError()
+{
+    // 写入返回 0 时没有 errno，当作没有空间
+    this->_error = errno != 0 ? errno : ENOSPC;
+}
+
+void FileWriter::advanceStream(size_t _count)
+{
+    if (this->_stream_window == 0 || this->_stream_start < 0) {
+        return;
+    }
+    int fd = this->_file._fd;
+    auto window = off64_t(this->_stream_window);
+    this->_stream_offset += off64_t(_count);
+    while (this->_stream_offset - this->_stream_start >= window) {
+        // 当前窗口写满，发起异步回写
+        ::sync_file_range(fd, this->_stream_start, window, SYNC_FILE_RANGE_WRITE);
+        // 等待上一个窗口写入完成，此时页面已经干净，可以丢弃
+        off64_t prev = this->_stream_start - window;
+        if (prev >= 0) {
+            ::sync_file_range(fd, prev, window,
+                              SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            ::posix_fadvise64(fd, prev, window, POSIX_FADV_DONTNEED);
+        }
+        this->_stream_start += window;
+    }
+}
+
+size_t FileWriter::flush()
+{
+    if (this->_buf.empty()) {
+        return 0;
+    }
+    size_t len = std::min(this->writeBytes(this->_buf.data(), this->_buf.size()), this->_buf.size());
+    // 未能写出的部分留在缓冲区，错误记录在 error() 中
+    this->_buf.erase(this->_buf.begin(), this->_buf.begin() + len);
+    return len;
+}
+
+void FileWriter::sync()
+{
+    this->flush();
+    switch (this->_sync_mode) {
+        case kSyncData:
+            this->_file.flushData();
+            break;
+        case kSyncFull:
+            this->_file.flush();
+            break;
+        default:
+            break;
+    }
 }
@@ -0,0 +1,157 @@
+/**
+* @File line_mapper.cc
+* @Date 2023-04-14
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "line_mapper.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace
+{
+    // 查找换行符时每次读取的大小
+    const size_t kScanSize = 4096;
+    // 每个线程分到的区域数量
+    const size_t kRangesPerThread = 4;
+
+    // 在 [_pos, _size) 中查找第一个换行符，返回换行符之后的位置，没有时返回 _size
+    off64_t nextLineStart(const File& _file, off64_t _pos, off64_t _size)
+    {
+        char buf[kScanSize];
+        while (_pos < _size) {
+            size_t want = size_t(std::min(off64_t(kScanSize), _size - _pos));
+            size_t len = _file.multiReadBytes((File::bytePtr)buf, size_t(_pos), want);
+            if (len == 0) {
+                return _size;
+            }
+            auto newline = (const char*)std::memchr(buf, '\n', len);
+            if (newline != nullptr) {
+                return _pos + (newline - buf) + 1;
+            }
+            _pos += off64_t(len);
+        }
+        return _size;
+    }
+}
+
+unsigned LineMapper::threadCount() const
+{
+    unsigned thread_count = this->_options.thread_count;
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return thread_count;
+}
+
+std::vector<LineMapper::Range> LineMapper::split(const File& _file) const
+{
+    std::vector<Range> ranges;
+    off64_t size = _file.size();
+    if (size <= 0) {
+        return ranges;
+    }
+    size_t count = std::min(size_t(this->threadCount()) * kRangesPerThread,
+                            std::max(size_t(1), size_t(size) / std::max(size_t(1), this->_options.min_range_size)));
+    off64_t start = 0;
+    for (size_t i = 1; i <= count && start < size; ++i) {
+        off64_t end = size;
+        if (i < count) {
+            // 从目标位置的前一个字节开始查找，目标位置恰好是行首时不会跳过一整行
+            off64_t target = std::max(start + 1, off64_t(size_t(size) / count * i));
+            end = nextLineStart(_file, target - 1, size);
+        }
+        if (end > start) {
+            ranges.push_back({start, size_t(end - start)});
+            start = end;
+        }
+    }
+    return ranges;
+}
+
+bool LineMapper::forEachBlock(const File& _file, const std::vector<Range>& _ranges, const BlockCallback& _callback) const
+{
+    if (_ranges.empty()) {
+        return bool(_file.size() >= 0);
+    }
+    MappedFile mapped;
+    if (this->_options.use_mmap) {
+        mapped = MappedFile::map(_file);
+        if (mapped) {
+            mapped.advise(MADV_SEQUENTIAL);
+        }
+    }
+    bool use_mmap = mapped && mapped.size() > 0;
+
+    std::atomic<size_t> next {0};
+    std::atomic<bool> failed {false};
+    auto worker = [&]() {
+        std::vector<char> buf;
+        size_t index;
+        while (!failed.load(std::memory_order_relaxed) && (index = next.fetch_add(1)) < _ranges.size()) {
+            const auto& range = _ranges[index];
+            if (use_mmap) {
+                if (range.offset + off64_t(range.length) > off64_t(mapped.size())) {
+                    failed.store(true);
+                    break;
+                }
+                _callback(index, (const char*)mapped.data() + range.offset, range.length);
+                continue;
+            }
+
+            // 每次读取一块，只回调到最后一个换行符，剩余部分移到缓冲区开头
+            if (buf.empty()) {
+                buf.resize(std::max(kScanSize, this->_options.buffer_size));
+            }
+            off64_t pos = range.offset;
+            size_t remain = range.length;
+            size_t carry = 0;
+            while (remain > 0) {
+                if (carry == buf.size()) {
+                    // 一行比缓冲区还长
+                    buf.resize(buf.size() * 2);
+                }
+                size_t want = std::min(buf.size() - carry, remain);
+                size_t len = _file.multiReadBytes((File::bytePtr)buf.data() + carry, size_t(pos), want);
+                if (len == 0) {
+                    failed.store(true);
+                    break;
+                }
+                pos += off64_t(len);
+                remain -= len;
+                size_t filled = carry + len;
+                if (remain == 0) {
+                    _callback(index, buf.data(), filled);
+                    break;
+                }
+                auto last = (const char*)memrchr(buf.data(), '\n', filled);
+                if (last == nullptr) {
+                    carry = filled;
+                    continue;
+                }
+                size_t block = size_t(last - buf.data()) + 1;
+                _callback(index, buf.data(), block);
+                carry = filled - block;
+                std::memmove(buf.data(), buf.data() + block, carry);
+            }
+        }
+    };
+
+    unsigned thread_count = unsigned(std::min(size_t(this->threadCount()), _ranges.size()));
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+    return !failed.load();
+}
@@ -0,0 +1,64 @@
+/**
+* @File mapped_file.cc
+* @Date 2023-04-11
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "mapped_file.h"
+#include <algorithm>
+
+MappedFile MappedFile::map(const File& _file)
+{
+    MappedFile mapped;
+    if (!_file) {
+        mapped._error = _file._error;
+        return mapped;
+    }
+    auto stat = FileStat::of(_file._fd, FileStat::kSize);
+    if (!stat) {
+        mapped._error = stat.error();
+        return mapped;
+    }
+    // 空文件不能映射，当作空的映射
+    if (stat.size() == 0) {
+        return mapped;
+    }
+    void* data = ::mmap(nullptr, size_t(stat.size()), PROT_READ, MAP_SHARED, _file._fd, 0);
+    if (data == MAP_FAILED) {
+        mapped._error = errno;
+        return mapped;
+    }
+    mapped._data = (File::byte*)data;
+    mapped._size = size_t(stat.size());
+    return mapped;
+}
+
+MappedFile MappedFile::map(const std::string& _path)
+{
+    return MappedFile::map(File::open(_path, File::kReadOnly));
+}
+
+void MappedFile::advise(int _advice, size_t _start, size_t _count) const
+{
+    if (this->_data == nullptr || _start >= this->_size) {
+        return;
+    }
+    // madvise 要求起始地址按页对齐
+    static const size_t page_size = size_t(::sysconf(_SC_PAGESIZE));
+    size_t begin = _start / page_size * page_size;
+    size_t end = std::min(this->_size, _start + std::min(_count, this->_size - _start));
+    ::madvise(this->_data + begin, end - begin, _advice);
+}
+
+void MappedFile::unmap()
+{
+    if (this->_data != nullptr) {
+        ::munmap(this->_data, this->_size);
+        this->_data = nullptr;
+        this->_size = 0;
+    }
+}
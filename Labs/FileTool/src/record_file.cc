@@ -0,0 +1,314 @@
+/**
+* @File record_file.cc
+* @Date 2023-04-11
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "record_file.h"
+#include "checksum.h"
+#include <limits>
+
+namespace
+{
+    const char kMagic[8] = {'L', 'S', 'R', 'E', 'C', 'O', 'R', 'D'};
+    static_assert(sizeof(RecordFileHeader) == 64, "record file header must be 64 bytes");
+    static_assert(sizeof(RecordBlockIndex) == 16, "block index must be 16 bytes");
+
+    uint32_t crc32c(uint32_t _crc, const void* _data, size_t _size)
+    {
+        return Crc32c::compute(_data, _size, _crc);
+    }
+
+    uint32_t headerCrc(RecordFileHeader _header)
+    {
+        _header.header_crc = 0;
+        return crc32c(0, &_header, sizeof(_header));
+    }
+}
+
+RecordFileWriter::RecordFileWriter(const std::string& _path, uint32_t _record_size, uint32_t _records_per_block)
+    : _writer(File::create(_path, 0644))
+{
+    if (this->_writer) {
+        ::ftruncate64(this->_writer.file()._fd, 0);
+    }
+    this->init(_record_size, _records_per_block);
+}
+
+RecordFileWriter::RecordFileWriter(FileWriter&& _writer, uint32_t _record_size, uint32_t _records_per_block)
+    : _writer(std::move(_writer))
+{
+    this->init(_record_size, _records_per_block);
+}
+
+void RecordFileWriter::init(uint32_t _record_size, uint32_t _records_per_block)
+{
+    std::memcpy(this->_header.magic, kMagic, sizeof(kMagic));
+    this->_header.version = kVersion;
+    this->_header.record_size = _record_size;
+    if (_records_per_block == 0) {
+        _records_per_block = kDefaultRecordsPerBlock;
+    }
+    // 块大小需要能用 uint32 表示
+    if (_record_size != 0) {
+        _records_per_block = std::min(_records_per_block,
+                                      uint32_t(std::numeric_limits<uint32_t>::max() / _record_size));
+        _records_per_block = std::max(_records_per_block, 1u);
+    }
+    this->_header.records_per_block = _records_per_block;
+    // 先写入占位头部，完成时再写入真正的头部
+    this->writeBytes(&this->_header, sizeof(this->_header));
+    this->_block_start = this->_offset;
+}
+
+bool RecordFileWriter::writeBytes(const void* _data, size_t _size)
+{
+    if (this->_failed) {
+        return false;
+    }
+    if (this->_writer.write(_data, _size) != _size) {
+        this->_failed = true;
+        return false;
+    }
+    this->_offset += _size;
+    return true;
+}
+
+bool RecordFileWriter::append(const void* _record, size_t _size)
+{
+    if (this->_finished || this->_failed) {
+        return false;
+    }
+    uint32_t record_size = this->_header.record_size;
+    if (record_size != 0 && _size != record_size) {
+        return false;
+    }
+    uint64_t block_size = this->_offset - this->_block_start;
+    if (record_size == 0) {
+        // 变长记录：长度前缀 + 数据，块内偏移需要用 uint32 表示
+        if (_size > std::numeric_limits<uint32_t>::max()
+            || block_size + sizeof(uint32_t) + _size > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+        auto len = uint32_t(_size);
+        this->_offsets.push_back(uint32_t(block_size));
+        this->_block_crc = crc32c(this->_block_crc, &len, sizeof(len));
+        this->writeBytes(&len, sizeof(len));
+    }
+    // 边写边计算校验和，不需要缓存整块数据
+    this->_block_crc = crc32c(this->_block_crc, _record, _size);
+    if (!this->writeBytes(_record, _size)) {
+        return false;
+    }
+    this->_header.record_count += 1;
+    if (++this->_block_records == this->_header.records_per_block) {
+        this->endBlock();
+    }
+    return true;
+}
+
+void RecordFileWriter::endBlock()
+{
+    if (this->_block_records == 0) {
+        return;
+    }
+    this->_blocks.push_back({this->_block_start, uint32_t(this->_offset - this->_block_start), this->_block_crc});
+    this->_block_start = this->_offset;
+    this->_block_records = 0;
+    this->_block_crc = 0;
+}
+
+bool RecordFileWriter::finish()
+{
+    if (this->_finished) {
+        return !this->_failed;
+    }
+    this->_finished = true;
+    this->endBlock();
+
+    // 索引按 8 字节对齐，映射后可以直接访问
+    static const File::byte padding[8] = {0};
+    size_t pad = size_t((8 - this->_offset % 8) % 8);
+    this->writeBytes(padding, pad);
+    this->_header.index_offset = this->_offset;
+    this->_header.block_count = this->_blocks.size();
+
+    uint32_t index_crc = crc32c(0, this->_blocks.data(), this->_blocks.size() * sizeof(RecordBlockIndex));
+    this->writeBytes(this->_blocks.data(), this->_blocks.size() * sizeof(RecordBlockIndex));
+    if (this->_header.record_size == 0) {
+        index_crc = crc32c(index_crc, this->_offsets.data(), this->_offsets.size() * sizeof(uint32_t));
+        this->writeBytes(this->_offsets.data(), this->_offsets.size() * sizeof(uint32_t));
+    }
+    this->_header.index_crc = index_crc;
+    this->_header.header_crc = headerCrc(this->_header);
+
+    this->_writer.flush();
+    if (this->_writer.pending() != 0) {
+        this->_failed = true;
+    }
+    if (!this->_failed) {
+        auto& file = this->_writer.file();
+        if (file.multiWriteBytes(reinterpret_cast<File::bytePtr>(&this->_header), 0, sizeof(this->_header)) != sizeof(this->_header)) {
+            this->_failed = true;
+        }
+    }
+    this->_writer.sync();
+    std::vector<RecordBlockIndex>().swap(this->_blocks);
+    std::vector<uint32_t>().swap(this->_offsets);
+    return !this->_failed;
+}
+
+RecordFileReader RecordFileReader::open(const std::string& _path)
+{
+    RecordFileReader reader;
+    reader._map = MappedFile::map(_path);
+    if (!reader._map) {
+        reader._error = "map file error";
+        return reader;
+    }
+    auto data = reader._map.data();
+    size_t size = reader._map.size();
+    if (size < sizeof(RecordFileHeader)) {
+        reader._error = "file too small";
+        return reader;
+    }
+    auto header = (const RecordFileHeader*)data;
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != RecordFileWriter::kVersion) {
+        reader._error = "bad magic or version";
+        return reader;
+    }
+    if (header->header_crc != headerCrc(*header)) {
+        reader._error = "header checksum mismatch";
+        return reader;
+    }
+    // 校验和只能发现意外损坏，字段之间是否一致需要单独检查，否则会除以 0 或者越界访问
+    uint64_t rpb = header->records_per_block;
+    if (rpb == 0) {
+        reader._error = "bad records per block";
+        return reader;
+    }
+    if (header->block_count > size / sizeof(RecordBlockIndex) || header->record_count > size
+        || header->block_count < (header->record_count + rpb - 1) / rpb) {
+        reader._error = "bad record or block count";
+        return reader;
+    }
+    uint64_t index_size = header->block_count * sizeof(RecordBlockIndex);
+    if (header->record_size == 0) {
+        index_size += header->record_count * sizeof(uint32_t);
+    }
+    if (header->index_offset % 8 != 0 || header->index_offset > size || index_size > size - header->index_offset) {
+        reader._error = "bad index offset";
+        return reader;
+    }
+    if (header->index_crc != crc32c(0, data + header->index_offset, index_size)) {
+        reader._error = "index checksum mismatch";
+        return reader;
+    }
+    auto blocks = (const RecordBlockIndex*)(data + header->index_offset);
+    auto offsets = (const uint32_t*)(data + header->index_offset + header->block_count * sizeof(RecordBlockIndex));
+    for (uint64_t i = 0; i < header->block_count; ++i) {
+        // 块需要在头部和索引之间
+        auto& block = blocks[i];
+        if (block.offset < sizeof(RecordFileHeader) || block.offset > header->index_offset
+            || block.size > header->index_offset - block.offset) {
+            reader._error = "bad block offset";
+            return reader;
+        }
+        uint64_t first = i * rpb;
+        uint64_t count = first < header->record_count ? std::min(rpb, header->record_count - first) : 0;
+        if (header->record_size != 0 && count * header->record_size > block.size) {
+            reader._error = "bad block size";
+            return reader;
+        }
+        // 变长记录的长度字段需要在块内，长度本身在 record 中检查，打开时不读取全部数据
+        for (uint64_t j = first; header->record_size == 0 && j < first + count; ++j) {
+            if (uint64_t(offsets[j]) + sizeof(uint32_t) > block.size) {
+                reader._error = "bad record offset";
+                return reader;
+            }
+        }
+    }
+    reader._header = header;
+    reader._blocks = blocks;
+    if (header->record_size == 0) {
+        reader._offsets = offsets;
+    }
+    reader._error = nullptr;
+    return reader;
+}
+
+RecordView RecordFileReader::record(uint64_t _index) const
+{
+    if (this->_header == nullptr || _index >= this->_header->record_count) {
+        return {nullptr, 0};
+    }
+    auto& block = this->_blocks[_index / this->_header->records_per_block];
+    auto data = this->_map.data();
+    uint32_t record_size = this->_header->record_size;
+    if (record_size != 0) {
+        return {data + block.offset + (_index % this->_header->records_per_block) * record_size, record_size};
+    }
+    uint32_t offset = this->_offsets[_index];
+    auto pos = data + block.offset + offset;
+    uint32_t len;
+    std::memcpy(&len, pos, sizeof(len));
+    // 长度超出所在块时文件已经损坏
+    if (len > block.size - offset - sizeof(len)) {
+        return {nullptr, 0};
+    }
+    return {pos + sizeof(len), len};
+}
+
+bool RecordFileReader::verifyBlock(uint64_t _block) const
+{
+    if (this->_header == nullptr || _block >= this->_header->block_count) {
+        return false;
+    }
+    auto& block = this->_blocks[_block];
+    if (block.offset + block.size > this->_header->index_offset) {
+        return false;
+    }
+    return crc32c(0, this->_map.data() + block.offset, block.size) == block.crc;
+}
+
+bool RecordFileReader::verify() const
+{
+    if (this->_header == nullptr) {
+        return false;
+    }
+    this->_map.advise(MADV_SEQUENTIAL);
+    for (uint64_t i = 0; i < this->_header->block_count; ++i) {
+        if (!this->verifyBlock(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t RecordFileReader::scan(uint64_t _first, uint64_t _last,
+                              const std::function<bool(uint64_t, const RecordView&)>& _callback) const
+{
+    _last = std::min(_last, this->count());
+    if (_first >= _last) {
+        return 0;
+    }
+    // 提示内核顺序预读这一段数据
+    auto begin = this->record(_first);
+    auto end = this->record(_last - 1);
+    size_t start = size_t(begin.data - this->_map.data());
+    this->_map.advise(MADV_SEQUENTIAL, start, size_t(end.data + end.size - begin.data));
+    this->_map.advise(MADV_WILLNEED, start, size_t(end.data + end.size - begin.data));
+
+    size_t count = 0;
+    for (uint64_t i = _first; i < _last; ++i) {
+        ++count;
+        if (!_callback(i, this->record(i))) {
+            break;
+        }
+    }
+    return count;
+}
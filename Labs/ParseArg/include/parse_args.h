@@ -230,7 +230,7 @@ private:
                 exit(1);
             }
             // 解析参数
-            auto pair = this->onParseArg(c, optarg);
+            auto pair = this->onParseArg(c, optarg != nullptr ? optarg : "");
             if (!pair.first.empty()) {
                 _data[pair.first] = pair.second;
             }
@@ -0,0 +1,93 @@
+/**
+* @File spawn_bench.cc
+* @Date 2023-04-21
+* @Description 父进程占用内存逐步增加时，对比 fork 和 posix_spawn 创建子进程的耗时
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "process.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+using namespace Process;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const size_t kStepSize = size_t(64) << 20;     // 每次增加的内存
+
+    // 当前常驻内存，单位 MB
+    size_t residentMB()
+    {
+        FILE* file = ::fopen("/proc/self/statm", "r");
+        if (file == nullptr) {
+            return 0;
+        }
+        unsigned long size = 0, resident = 0;
+        if (::fscanf(file, "%lu %lu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        ::fclose(file);
+        return size_t(resident) * size_t(::sysconf(_SC_PAGESIZE)) >> 20;
+    }
+
+    double percentile(std::vector<double>& values, double p)
+    {
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, size_t(p * double(values.size())))];
+    }
+
+    void benchSpawn(const char* name, SpawnMode mode, int count, size_t rss)
+    {
+        std::vector<double> spawn_us, run_us;
+        for (int i = 0; i < count; ++i) {
+            auto start = Clock::now();
+            auto command = Command::New("true");
+            command.spawnMode(mode).start();
+            auto spawned = Clock::now();
+            if (!command.wait()) {
+                printf("%s: run command error\n", name);
+                return;
+            }
+            auto done = Clock::now();
+            spawn_us.push_back(std::chrono::duration<double, std::micro>(spawned - start).count());
+            run_us.push_back(std::chrono::duration<double, std::micro>(done - start).count());
+        }
+        printf("%8zu MB  %-12s  spawn p50 %9.1f us  p99 %9.1f us   run p50 %9.1f us\n",
+               rss, name, percentile(spawn_us, 0.5), percentile(spawn_us, 0.99), percentile(run_us, 0.5));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_mb = argc > 1 ? size_t(std::strtoul(argv[1], nullptr, 10)) : 2048;
+    int count = argc > 2 ? std::max(1, std::atoi(argv[2])) : 100;
+    printf(">> max rss: %zu MB, spawn count: %d\n", max_mb, count);
+
+    // 内存需要写入才会占用物理页，fork 时才需要复制页表
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t allocated = 0;
+    for (size_t target = 0; ; target = target == 0 ? 256 : target * 2) {
+        target = std::min(target, max_mb);
+        while (allocated < target) {
+            blocks.emplace_back(new char[kStepSize]);
+            std::memset(blocks.back().get(), 1, kStepSize);
+            allocated += kStepSize >> 20;
+        }
+        size_t rss = residentMB();
+        benchSpawn("fork", SpawnMode::kFork, count, rss);
+        benchSpawn("posix_spawn", SpawnMode::kPosixSpawn, count, rss);
+        if (target >= max_mb) {
+            break;
+        }
+    }
+    return 0;
+}
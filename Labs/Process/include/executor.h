@@ -0,0 +1,98 @@
+/**
+* @File executor.h
+* @Date 2023-04-22
+* @Description 并行执行大量命令，限制同时运行的数量，所有子进程的管道和退出在一个 epoll 循环中处理
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+#ifndef __LINUX_STUDY_PROCESS_EXECUTOR_H
+#define __LINUX_STUDY_PROCESS_EXECUTOR_H
+
+#include "process.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Process
+{
+    class Executor
+    {
+    public:
+        // 命令完成后在事件循环线程中调用，不要在回调中长时间阻塞
+        typedef std::function<void(Result& result)> Callback;
+
+        // max_running 为同时运行的子进程数量，0 表示 CPU 核心数
+        explicit Executor(unsigned max_running = 0);
+        // 等待已经提交的命令全部完成
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+        Executor& operator = (const Executor&) = delete;
+
+    public:
+        // 提交命令，达到并发上限时排队，按提交顺序启动
+        void submit(Command command, Callback callback);
+        std::future<Result> submit(Command command);
+        // 阻塞直到已经提交的命令全部完成
+        void waitAll();
+
+        unsigned maxRunning() const {
+            return _max_running;
+        }
+        // 排队和正在运行的命令数量
+        size_t unfinished() const;
+
+    private:
+        struct Task;
+        // 一个需要监听的描述符，epoll 事件中保存它的地址
+        struct Watch
+        {
+            Task* task;
+            int* fd;
+        };
+        struct Task
+        {
+            Command command;
+            Callback callback;
+            Watch watches[4];       // 标准输入、标准输出、标准错误、子进程 pidfd
+
+            Task(Command&& cmd, Callback&& cb)
+                : command(std::move(cmd))
+                , callback(std::move(cb))
+            {}
+        };
+
+        void loop();
+        // 从队列中启动命令直到达到并发上限
+        void startTasks();
+        void watch(Watch& watch, uint32_t events);
+        void unwatch(int& fd);
+        // 子进程退出且输出全部读完时调用回调
+        void tryFinish(std::unique_ptr<Task>& task);
+        // 子进程没有 pidfd，需要定期非阻塞地检查是否退出
+        static bool polling(const Task& task);
+        void wakeup() const;
+
+    private:
+        unsigned _max_running;
+        int _epoll_fd {-1};
+        int _event_fd {-1};             // 提交命令和析构时唤醒事件循环
+        std::thread _thread;
+        mutable std::mutex _lock;
+        std::condition_variable _idle;  // 全部命令完成时通知
+        std::deque<std::unique_ptr<Task>> _queue;   // 等待启动的命令
+        std::vector<std::unique_ptr<Task>> _running;    // 只在事件循环线程中访问
+        size_t _unfinished {0};         // 排队和正在运行的命令数量
+        bool _stopping {false};
+
+    }; // Executor
+
+}
+
+#endif // __LINUX_STUDY_PROCESS_EXECUTOR_H
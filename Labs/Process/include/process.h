@@ -11,18 +11,30 @@
 #define __LINUX_STUDY_PROCESS_PROCESS_H
 
 #include <unistd.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <functional>
 #include <string>
 #include <vector>
 
 namespace Process
 {
+    // 创建子进程的方式
+    enum class SpawnMode : int {
+        kPosixSpawn = 0,    // posix_spawn，glibc 中使用 clone(CLONE_VM | CLONE_VFORK)，不复制父进程页表
+        kFork,              // fork + exec，父进程占用内存越多越慢，之后还会产生写时复制缺页
+    };
+
+    // 流式输出回调，data 只在回调期间有效，按行回调时不含换行符
+    typedef std::function<void(const char* data, size_t len)> OutputCallback;
+
     // 命令结果
     class Result
     {
     public:
         friend class Command;
+        friend class Executor;
         ~Result() = default;
 
         Result(const Result&) = default;
@@ -55,8 +67,8 @@ namespace Process
         size_t error(char* buf, size_t len, size_t start) const
         {
             size_t i = start;
-            for (; i < len && i < _output_buf.size(); ++i) {
-                buf[i] = _output_buf[i];
+            for (; i < len && i < _error_buf.size(); ++i) {
+                buf[i] = _error_buf[i];
             }
             return i;
         }
@@ -67,16 +79,39 @@ namespace Process
         }
 
     protected:
-        // 读取子进程输出到字符串中
-        void readToBuf();
-        // 初始化管道
-        void initPipe();
-        // 初始化父进程管道
-        void initInParent() const;
-        // 初始化子进程管道
+        // 初始化管道，pipe_size 不为 0 时设置管道容量
+        void initPipe(size_t pipe_size = 0);
+        // 初始化父进程管道，关闭子进程使用的一端，父进程一端设置为非阻塞
+        void initInParent();
+        // 初始化子进程管道，fork 之后在子进程中调用
         void initInChild() const;
-        // 写入输入到子进程标准输入
-        void writeToInput(std::string& input) const;
+        // 通过 posix_spawn 的文件操作重定向子进程标准输入输出
+        void initFileActions(posix_spawn_file_actions_t* actions) const;
+        // 写入输入到子进程标准输入，管道满时返回 false，全部写完或者子进程不再读取时关闭写入端
+        bool writeToInput(const std::string& input);
+        // 同时写入标准输入、读取标准输出和错误，直到两个输出管道都读到文件尾
+        void pumpIO(const std::string& input);
+        // 只等待一轮，最多等待 timeout 毫秒，-1 不限时，wake_fd 可读时也返回，poll 出错时返回 false
+        bool pollIO(const std::string& input, int timeout, int wake_fd = -1);
+        // 以下在管道可读写时调用，不关闭管道，返回 false 表示该管道已经结束，由调用者关闭
+        // 写入剩余的输入
+        bool pushInput(const std::string& input);
+        // 读取标准输出或者错误中现有的数据，设置了回调或者错误输出上限时交给 streamOutput
+        bool pullOutput(bool error);
+        bool streamOutput(bool error);
+        // 把读到的一块数据交给回调，按行回调时不完整的一行留到下一块
+        void dispatch(bool error, const char* data, size_t len);
+        // 管道结束时回调最后不完整的一行，错误输出环形缓冲区整理为顺序
+        void finishStream(bool error);
+        // 错误输出写入环形缓冲区，只保留最后 _error_tail 字节
+        void appendErrorTail(const char* data, size_t len);
+        // posix_spawn 返回 exec 错误时，按 fork 模式下 exec 失败的方式记录错误输出和返回值
+        void execFailed(int err);
+        // 父进程一端的管道是否都已经关闭
+        bool pipesClosed() const {
+            return _input_pipe[1] < 0 && _output_pipe[0] < 0 && _error_pipe[0] < 0;
+        }
+        static void closeFd(int& fd);
 
         explicit Result()
                 : _input_pipe{-1, -1}
@@ -84,20 +119,8 @@ namespace Process
                 , _error_pipe{-1, -1}
         {  }
 
-        // 关闭管道
-        void closePipe() const
-        {
-            if (_status > 1) {
-                // 不确定标准输入父进程写入端是否关闭，选择关闭，已关闭会返回错误，选择忽略
-                ::close(_input_pipe[1]);
-                if (_status > 2) {
-                    ::close(_output_pipe[0]);
-                    if (_status > 3) {
-                        ::close(_error_pipe[0]);
-                    }
-                }
-            }
-        }
+        // 关闭父进程还没有关闭的管道
+        void closePipe();
 
     private:
         int _ret_code{0};           // 程序返回值
@@ -107,12 +130,24 @@ namespace Process
         int _error_pipe[2];         // 标准错误管道
         std::string _output_buf;    // 标准输出缓冲区
         std::string _error_buf;     // 标准错误缓冲区
+        size_t _input_offset {0};   // 已经写入标准输入的长度
+
+        OutputCallback _output_callback;    // 设置后标准输出不再保存到 _output_buf
+        OutputCallback _error_callback;     // 设置后标准错误只保存最后 _error_tail 字节
+        bool _output_by_line {false};
+        bool _error_by_line {false};
+        std::string _output_line;   // 按行回调时还没有结束的一行，重复使用
+        std::string _error_line;
+        std::string _read_buf;      // 流式读取使用的缓冲区，重复使用
+        size_t _error_tail {0};     // 标准错误最多保存的字节数，0 为不限制
+        size_t _error_head {0};     // 环形缓冲区中最早的数据位置
 
     }; // Result
 
     // 命令
     class Command
     {
+        friend class Executor;
     public:
         // 静态函数，用于构造命令
         static Command New(std::string& cmd) {
@@ -125,10 +160,10 @@ namespace Process
         Command(const Command&) = delete;
         Command& operator = (const Command&) = delete;
 
-        Command(Command&& c) noexcept = default;
-        Command& operator = (Command&&) = default;
-
-        ~Command() = default;
+        // 移动后原命令不再持有子进程和 pidfd
+        Command(Command&& c) noexcept;
+        Command& operator = (Command&& c) noexcept;
+        ~Command();
 
     public:
         // 添加一个参数
@@ -198,12 +233,61 @@ namespace Process
             return *this;
         }
 
+        // 子进程运行期间把标准输出交给回调，by_line 为 true 时每次回调一行，不再保存到 Result::output
+        // 回调在 wait、tryWait、waitFor 的线程中执行，通过 Executor 执行时在事件循环线程中执行
+        Command& onOutput(OutputCallback callback, bool by_line = false)
+        {
+            _result._output_callback = std::move(callback);
+            _result._output_by_line = by_line;
+            return *this;
+        }
+        // 同上，用于标准错误，Result::error 只保留 errorTail 设置的最后一部分
+        Command& onError(OutputCallback callback, bool by_line = false)
+        {
+            _result._error_callback = std::move(callback);
+            _result._error_by_line = by_line;
+            return *this;
+        }
+        // Result::error 只保留标准错误最后 size 字节，用于出错时显示，0 为全部保存
+        // 设置了 onError 但没有设置上限时不保存标准错误
+        Command& errorTail(size_t size)
+        {
+            _result._error_tail = size;
+            return *this;
+        }
+
+        // 创建子进程的方式，默认使用 defaultSpawnMode()
+        Command& spawnMode(SpawnMode mode)
+        {
+            _spawn_mode = mode;
+            return *this;
+        }
+        // 设置管道容量，子进程大量输出时减少切换次数，超过 /proc/sys/fs/pipe-max-size 时保持默认
+        Command& pipeSize(size_t size)
+        {
+            _pipe_size = size;
+            return *this;
+        }
+        // 之后新建的命令默认使用的创建方式
+        static void setDefaultSpawnMode(SpawnMode mode);
+        static SpawnMode defaultSpawnMode();
+
         // 阻塞执行，子进程 + wait 阻塞
         Result& run();
-        // 异步执行，子进程
+        // 异步执行，子进程，只写入管道能容纳的输入，不会阻塞
         Command& start();
-        // 等待子进程执行完成
+        // 写入剩余的输入并读取输出，输出全部读完后等待子进程退出
         Result& wait();
+        // 不阻塞，读写管道中现有的数据，子进程已经退出且输出读完时返回 true，之后结果不再变化
+        bool tryWait() {
+            return waitFor(0);
+        }
+        // 最多等待 timeout 毫秒，-1 不限时，同时 poll 管道和 pidfd，不用睡眠轮询
+        bool waitFor(int timeout);
+        // start 之后子进程的 pidfd，子进程退出时可读，可以加入调用者自己的 epoll 中，可读后调用 tryWait
+        // 输出超过管道容量时子进程会阻塞在写入上不会退出，这类命令需要同时定期调用 tryWait 或者使用 Executor
+        // 第一次调用时打开，子进程回收后关闭，内核不支持（Linux 5.3 之前）或者没有子进程时返回 -1
+        int pidFd();
 
     protected:
         explicit Command(std::string& cmd)
@@ -217,13 +301,25 @@ namespace Process
             _args.emplace_back(cmd);
         }
 
+    private:
+        // 创建子进程并写入输入，run 和 start 共用
+        bool spawn();
+        // 返回 posix_spawn 的错误码
+        int spawnByPosixSpawn(char* const* args, char* const* envs);
+        void spawnByFork(char* const* args, char* const* envs);
+        // 回收子进程并关闭 pidfd，options 为 WNOHANG 且子进程没有退出时返回 false
+        bool reap(int options);
+
     private:
         Result _result;                 // 执行结果
         pid_t _pid {0};                 // 子进程 pid
+        int _pid_fd {-1};               // 子进程 pidfd，没有打开时为 -1
         std::string _command;           // 命令
         std::string _input_buf;         // 输入缓冲区
         std::vector<std::string> _args; // 命令行参数
         std::vector<std::string> _envs; // 环境变量
+        SpawnMode _spawn_mode {defaultSpawnMode()};     // 创建子进程的方式
+        size_t _pipe_size {0};          // 管道容量，0 为系统默认
 
     }; // Command
 
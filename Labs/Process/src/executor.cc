@@ -0,0 +1,245 @@
+/**
+* @File executor.cc
+* @Date 2023-04-22
+* @Description
+* @Author Ticks
+* @Email ticks.cc\@gmail.com
+*
+* Copyright 2023 Ticks, Inc. All rights reserved.
+**/
+
+#include "executor.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+
+namespace
+{
+    const int kMaxEvents = 64;
+    const int kReapInterval = 10;      // 不支持 pidfd 时轮询子进程退出的间隔，毫秒
+}
+
+Process::Executor::Executor(unsigned max_running)
+    : _max_running(max_running != 0 ? max_running : std::max(1u, std::thread::hardware_concurrency()))
+{
+    _epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    _event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_epoll_fd < 0 || _event_fd < 0) {
+        ::perror("create executor event loop error");
+        return;
+    }
+    struct epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &event);
+    _thread = std::thread(&Executor::loop, this);
+}
+
+Process::Executor::~Executor()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopping = true;
+    }
+    wakeup();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    if (_epoll_fd >= 0) {
+        ::close(_epoll_fd);
+    }
+    if (_event_fd >= 0) {
+        ::close(_event_fd);
+    }
+}
+
+void Process::Executor::submit(Command command, Callback callback)
+{
+    if (!_thread.joinable()) {
+        // 事件循环没有创建成功，直接在当前线程执行
+        callback(command.run());
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _queue.emplace_back(new Task(std::move(command), std::move(callback)));
+        ++_unfinished;
+    }
+    wakeup();
+}
+
+std::future<Process::Result> Process::Executor::submit(Command command)
+{
+    auto promise = std::make_shared<std::promise<Result>>();
+    auto future = promise->get_future();
+    submit(std::move(command), [promise](Result& result) {
+        promise->set_value(std::move(result));
+    });
+    return future;
+}
+
+void Process::Executor::waitAll()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    _idle.wait(lock, [this]() {
+        return _unfinished == 0;
+    });
+}
+
+size_t Process::Executor::unfinished() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _unfinished;
+}
+
+void Process::Executor::wakeup() const
+{
+    uint64_t value = 1;
+    if (_event_fd >= 0 && ::write(_event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        ::perror("wake up executor error");
+    }
+}
+
+void Process::Executor::watch(Watch& watch, uint32_t events)
+{
+    if (*watch.fd < 0) {
+        return;
+    }
+    struct epoll_event event {};
+    event.events = events;
+    event.data.ptr = &watch;
+    if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, *watch.fd, &event) != 0) {
+        ::perror("watch pipe error");
+    }
+}
+
+void Process::Executor::unwatch(int& fd)
+{
+    // 先从 epoll 中移除再关闭，避免描述符被复用后收到旧的事件
+    if (fd >= 0) {
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        Result::closeFd(fd);
+    }
+}
+
+void Process::Executor::startTasks()
+{
+    while (_running.size() < _max_running) {
+        std::unique_ptr<Task> task;
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            if (_queue.empty()) {
+                break;
+            }
+            task = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        auto& command = task->command;
+        auto& result = command._result;
+        if (!command.spawn()) {
+            // 创建失败时管道已经关闭，直接完成
+            tryFinish(task);
+            continue;
+        }
+        command.pidFd();
+        task->watches[0] = Watch {task.get(), &result._input_pipe[1]};
+        task->watches[1] = Watch {task.get(), &result._output_pipe[0]};
+        task->watches[2] = Watch {task.get(), &result._error_pipe[0]};
+        task->watches[3] = Watch {task.get(), &command._pid_fd};
+        watch(task->watches[0], EPOLLOUT);
+        watch(task->watches[1], EPOLLIN);
+        watch(task->watches[2], EPOLLIN);
+        watch(task->watches[3], EPOLLIN);
+        _running.push_back(std::move(task));
+    }
+}
+
+bool Process::Executor::polling(const Task& task)
+{
+    return task.command._pid > 0 && task.command._pid_fd < 0;
+}
+
+void Process::Executor::tryFinish(std::unique_ptr<Task>& task)
+{
+    if (task->command._pid > 0 || !task->command._result.pipesClosed()) {
+        return;
+    }
+    // 置空后由事件循环从 _running 中移除
+    std::unique_ptr<Task> done = std::move(task);
+    done->command._result.closePipe();
+    done->callback(done->command._result);
+    std::lock_guard<std::mutex> guard(_lock);
+    if (--_unfinished == 0) {
+        _idle.notify_all();
+    }
+}
+
+void Process::Executor::loop()
+{
+    struct epoll_event events[kMaxEvents];
+    while (true) {
+        startTasks();
+        bool need_poll = false;
+        for (auto& task : _running) {
+            need_poll = need_poll || polling(*task);
+        }
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            if (_stopping && _unfinished == 0) {
+                break;
+            }
+        }
+
+        int count = ::epoll_wait(_epoll_fd, events, kMaxEvents, need_poll ? kReapInterval : -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::perror("executor wait event error");
+            break;
+        }
+        for (int i = 0; i < count; ++i) {
+            auto watch = (Watch*)events[i].data.ptr;
+            if (watch == nullptr) {
+                uint64_t value;
+                while (::read(_event_fd, &value, sizeof(value)) > 0) {}
+                continue;
+            }
+            Task& task = *watch->task;
+            auto& result = task.command._result;
+            if (watch->fd == &task.command._pid_fd) {
+                // pidfd 可读时子进程已经退出，回收时会关闭 pidfd，先从 epoll 中移除
+                ::epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, task.command._pid_fd, nullptr);
+                task.command.reap(WNOHANG);
+                continue;
+            }
+            if (*watch->fd < 0) {
+                continue;
+            }
+            bool open;
+            if (watch->fd == &result._input_pipe[1]) {
+                open = result.pushInput(task.command._input_buf);
+            } else {
+                open = result.pullOutput(watch->fd == &result._error_pipe[0]);
+            }
+            if (!open) {
+                unwatch(*watch->fd);
+            }
+        }
+
+        // 没有 pidfd 的子进程轮询，然后处理完成的命令
+        for (size_t i = 0; i < _running.size(); ++i) {
+            if (_running[i] != nullptr && polling(*_running[i])) {
+                _running[i]->command.reap(WNOHANG);
+            }
+        }
+        for (size_t i = 0; i < _running.size(); ++i) {
+            if (_running[i] != nullptr) {
+                tryFinish(_running[i]);
+            }
+        }
+        _running.erase(std::remove(_running.begin(), _running.end(), nullptr), _running.end());
+    }
+}
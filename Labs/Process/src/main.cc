@@ -17,8 +17,9 @@ using namespace Process;
 
 int main(int argc, char* const* argv)
 {
-    auto& comm = Command::New("grep")
-            .arg("hello")
+    // start 返回的引用指向 comm，comm 需要保存到 wait 之后
+    auto comm = Command::New("grep");
+    comm.arg("hello")
             .input("I am input text\n")
             .input({
                 "hello, world\n",
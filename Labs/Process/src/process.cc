@@ -9,106 +9,218 @@
 **/
 
 #include "process.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
 
-Process::Result& Process::Command::run()
+namespace
 {
-    // vector<string> 不能直接转换为 char* const char*
-    char** args = new char*[_args.size() + 1];
-    char** envs = new char*[_envs.size() + 1];
-    // 数组最后一个元素为空
-    args[_args.size()] = nullptr;
-    envs[_envs.size()] = nullptr;
-    // 填充参数
-    for (int i = 0; i < _args.size(); ++i) {
-        args[i] = new char[_args[i].size() + 1];
-        std::strcpy(args[i], _args[i].data());
-    }
-    // 填充环境变量
-    for (int i = 0; i < _envs.size(); ++i) {
-        envs[i] = new char[_envs[i].size() + 1];
-        std::strcpy(envs[i], _envs[i].data());
+    const size_t kReadSize = 64 * 1024;    // 每次从管道读取的大小
+    const int kReapInterval = 10;           // 不支持 pidfd 时检查子进程退出的间隔，毫秒
+
+    // 新建命令默认的创建方式
+    std::atomic<int> g_default_spawn_mode {int(Process::SpawnMode::kPosixSpawn)};
+
+    // 参数直接指向 string 的内容，exec 系列函数不会修改，不需要拷贝，数组最后一个元素为空
+    std::vector<char*> toArgv(const std::vector<std::string>& strs)
+    {
+        std::vector<char*> argv;
+        argv.reserve(strs.size() + 1);
+        for (auto& it : strs) {
+            argv.push_back(const_cast<char*>(it.c_str()));
+        }
+        argv.push_back(nullptr);
+        return argv;
     }
 
-    long res;
-    _result.initPipe();
+    // 子进程提前关闭标准输入时写入会产生 SIGPIPE，写入期间屏蔽该信号，产生的信号直接取走
+    ssize_t writeNoSigPipe(int fd, const char* data, size_t len)
+    {
+        sigset_t pipe_set, old_set, pending;
+        ::sigemptyset(&pipe_set);
+        ::sigaddset(&pipe_set, SIGPIPE);
+        ::pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+        ::sigpending(&pending);
+        bool was_pending = ::sigismember(&pending, SIGPIPE);
 
-    // 创建子进程，子进程中使用 exec 系列函数执行
-    _pid = ::fork();
-    if (_pid == 0) {
-        // 子进程
-        _result.initInChild();
-        if (!_envs.empty()) {
-            res = ::execve(_command.data(), args, envs);
-        }else {
-            res = ::execvp(_command.data(), args);
+        ssize_t res = ::write(fd, data, len);
+        int err = errno;
+        if (res < 0 && err == EPIPE && !was_pending) {
+            struct timespec zero {0, 0};
+            ::sigtimedwait(&pipe_set, nullptr, &zero);
         }
-        if (res == -1) {
-            ::perror("exec command error");
+        ::pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+        errno = err;
+        return res;
+    }
+
+    // 读取管道中现有的数据直接追加到 buf，读到文件尾或出错时返回 false
+    // 读到 EAGAIN 为止，子进程退出后一轮就能读到文件尾，tryWait 不需要多等一轮
+    bool readPipe(int fd, std::string& buf)
+    {
+        while (true) {
+            size_t old_size = buf.size();
+            buf.resize(old_size + kReadSize);
+            ssize_t len = ::read(fd, &buf[old_size], kReadSize);
+            buf.resize(old_size + (len > 0 ? size_t(len) : 0));
+            if (len > 0) {
+                continue;
+            }
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            return len < 0 && errno == EAGAIN;
         }
-        ::_exit(1);
+    }
+}
 
-    } else if (_pid < 0) {
-        // 错误
-        _result._ret_code = -1;
-        ::perror("create child program error");
+Process::Command::Command(Command&& c) noexcept
+    : _result(std::move(c._result))
+    , _pid(c._pid)
+    , _pid_fd(c._pid_fd)
+    , _command(std::move(c._command))
+    , _input_buf(std::move(c._input_buf))
+    , _args(std::move(c._args))
+    , _envs(std::move(c._envs))
+    , _spawn_mode(c._spawn_mode)
+    , _pipe_size(c._pipe_size)
+{
+    c._pid = 0;
+    c._pid_fd = -1;
+}
+
+Process::Command& Process::Command::operator = (Command&& c) noexcept
+{
+    if (this != &c) {
+        Result::closeFd(_pid_fd);
+        _result = std::move(c._result);
+        _pid = c._pid;
+        _pid_fd = c._pid_fd;
+        _command = std::move(c._command);
+        _input_buf = std::move(c._input_buf);
+        _args = std::move(c._args);
+        _envs = std::move(c._envs);
+        _spawn_mode = c._spawn_mode;
+        _pipe_size = c._pipe_size;
+        c._pid = 0;
+        c._pid_fd = -1;
+    }
+    return *this;
+}
+
+Process::Command::~Command()
+{
+    Result::closeFd(_pid_fd);
+}
+
+void Process::Command::setDefaultSpawnMode(SpawnMode mode)
+{
+    g_default_spawn_mode.store(int(mode));
+}
+
+Process::SpawnMode Process::Command::defaultSpawnMode()
+{
+    return SpawnMode(g_default_spawn_mode.load());
+}
+
+Process::Result& Process::Command::run()
+{
+    // 阻塞等待子进程完成退出
+    return start().wait();
+}
+
+Process::Command& Process::Command::start()
+{
+    // 不用阻塞等待
+    spawn();
+    return *this;
+}
 
-    }else {
-        // 父进程
-        _result.initInParent();
-        // 通过写入管道向子进程标准输入输出内容
-        if (!_input_buf.empty()) {
-            _result.writeToInput(_input_buf);
-        }
-        // 阻塞等待子进程完成退出
-        res = ::waitpid(_pid, &_result._ret_code, 0);
-        if (res != _pid) {
-            _result._ret_code = -1;
+bool Process::Command::spawn()
+{
+    auto args = toArgv(_args);
+    auto envs = toArgv(_envs);
+    _result.initPipe(_pipe_size);
+
+    SpawnMode mode = _spawn_mode;
+    int exec_err = 0;
+    if (mode == SpawnMode::kPosixSpawn) {
+        int err = spawnByPosixSpawn(args.data(), envs.data());
+        if (err == ENOSYS) {
+            // 不支持时退回 fork
+            mode = SpawnMode::kFork;
+        } else if (err == EAGAIN || err == ENOMEM) {
+            // 和 fork 失败一样，子进程没有创建出来
+            errno = err;
+            ::perror("create child program error");
         } else {
-            // 成功退出，通过管道读取子进程输出
-            _result.readToBuf();
+            // 其余是 exec 阶段的错误，posix_spawn 在父进程中返回
+            exec_err = err;
         }
-        // 子进程执行完成，关闭管道
-        _result.closePipe();
     }
-    // 回收内存
-    for (int i = 0; i < _envs.size(); ++i) {
-        delete[] envs[i];
+    if (mode == SpawnMode::kFork) {
+        spawnByFork(args.data(), envs.data());
     }
-    for (int i = 0; i < _args.size(); ++i) {
-        delete[] args[i];
+
+    // 关闭子进程使用的管道端，父进程一端改为非阻塞
+    _result.initInParent();
+    if (_pid <= 0) {
+        // 错误
+        _result._ret_code = -1;
+        _result.closePipe();
+        if (exec_err != 0) {
+            _result.execFailed(exec_err);
+        }
+        return false;
     }
-    delete[] envs;
-    delete[] args;
-    return _result;
+    // 通过写入管道向子进程标准输入输出内容，管道满时剩余部分在 wait 中写入
+    _result.writeToInput(_input_buf);
+    return true;
 }
 
-Process::Command& Process::Command::start()
+int Process::Command::spawnByPosixSpawn(char* const* args, char* const* envs)
 {
-    char** args = new char*[_args.size() + 1];
-    char** envs = new char*[_envs.size() + 1];
-    args[_args.size()] = nullptr;
-    envs[_envs.size()] = nullptr;
-    for (int i = 0; i < _args.size(); ++i) {
-        args[i] = new char[_args[i].size() + 1];
-        std::strcpy(args[i], _args[i].data());
+    posix_spawn_file_actions_t actions;
+    int err = ::posix_spawn_file_actions_init(&actions);
+    if (err != 0) {
+        _pid = -1;
+        return err;
     }
-    for (int i = 0; i < _envs.size(); ++i) {
-        envs[i] = new char[_envs[i].size() + 1];
-        std::strcpy(envs[i], _envs[i].data());
+    _result.initFileActions(&actions);
+    // 设置了环境变量时和 execve 一样不搜索 PATH
+    if (!_envs.empty()) {
+        err = ::posix_spawn(&_pid, _command.c_str(), &actions, nullptr, args, envs);
+    } else {
+        err = ::posix_spawnp(&_pid, _command.c_str(), &actions, nullptr, args, environ);
     }
+    ::posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        _pid = -1;
+    }
+    return err;
+}
 
-    long res;
-    _result.initPipe();
-
+void Process::Command::spawnByFork(char* const* args, char* const* envs)
+{
+    // 创建子进程，子进程中使用 exec 系列函数执行
     _pid = ::fork();
     if (_pid == 0) {
         // 子进程
         _result.initInChild();
+        long res;
         if (!_envs.empty()) {
-            res = ::execve(_command.data(), args, envs);
+            res = ::execve(_command.c_str(), args, envs);
         }else {
-            res = ::execvp(_command.data(), args);
+            res = ::execvp(_command.c_str(), args);
         }
         if (res == -1) {
             ::perror("exec command error");
@@ -118,134 +230,375 @@ Process::Command& Process::Command::start()
     } else if (_pid < 0) {
         // 错误
         ::perror("create child program error");
-        _result._ret_code = -1;
-
-    }else {
-        // 父进程
-        _result.initInParent();
-        if (!_input_buf.empty()) {
-            _result.writeToInput(_input_buf);
-        }
-        // 不用阻塞等待
-    }
-    // 回收内存，子进程已经克隆一份了，可以回收
-    for (int i = 0; i < _envs.size(); ++i) {
-        delete[] envs[i];
     }
-    for (int i = 0; i < _args.size(); ++i) {
-        delete[] args[i];
-    }
-    delete[] envs;
-    delete[] args;
-    return *this;
 }
 
 Process::Result& Process::Command::wait()
 {
-    // 阻塞等待
-    int res = ::waitpid(_pid, &_result._ret_code, 0);
-    if (res != _pid) {
-        _result._ret_code = -1;
-    }else {
-        _result.readToBuf();
-    }
-    // 子进程执行完成，关闭管道
+    // 子进程没有创建成功或者已经等待过时管道都已关闭，结果不变
+    // 子进程运行期间同时读写管道，输出超过管道容量时子进程不会阻塞
+    _result.pumpIO(_input_buf);
     _result.closePipe();
+    // 输出都读到文件尾之后再阻塞等待
+    if (_pid > 0) {
+        reap(0);
+    }
     return _result;
 }
 
-void Process::Result::readToBuf()
+bool Process::Command::waitFor(int timeout)
 {
-    std::vector<char> buf(65);
-    long read_len;
-    do {
-        read_len = ::read(_output_pipe[0], buf.data(), 64);
-        if (read_len > 0) {
-            _output_buf.append(buf.begin(), buf.begin() + read_len);
+    typedef std::chrono::steady_clock Clock;
+    auto deadline = Clock::now() + std::chrono::milliseconds(std::max(timeout, 0));
+    // 至少读写一轮管道，timeout 为 0 时也能取走现有的输出
+    for (bool first = true; ; first = false) {
+        if (_pid > 0) {
+            reap(WNOHANG);
         }
-    } while (read_len > 0);
-    do {
-        read_len = ::read(_error_pipe[0], buf.data(), 64);
-        if (read_len > 0) {
-            _error_buf.append(buf.begin(), buf.begin() + read_len);
+        if (_pid <= 0 && _result.pipesClosed()) {
+            return true;
         }
-    } while (read_len > 0);
+        int wait_ms = -1;
+        if (timeout >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (left <= 0 && !first) {
+                return false;
+            }
+            wait_ms = int(std::max<decltype(left)>(left, 0));
+        }
+        int pid_fd = _pid > 0 ? pidFd() : -1;
+        if (_pid > 0 && pid_fd < 0) {
+            if (_result.pipesClosed()) {
+                if (timeout < 0) {
+                    reap(0);
+                    continue;
+                }
+                // 只剩子进程，没有 pidfd 时只能分段睡眠后再检查
+                ::poll(nullptr, 0, std::min(wait_ms, kReapInterval));
+                continue;
+            }
+            // 子进程一般在退出时关闭管道，poll 会被唤醒，这里只是防止子进程的子进程持有管道
+            wait_ms = wait_ms < 0 ? kReapInterval : std::min(wait_ms, kReapInterval);
+        }
+        if (!_result.pollIO(_input_buf, wait_ms, pid_fd)) {
+            return false;
+        }
+    }
+}
+
+int Process::Command::pidFd()
+{
+    if (_pid_fd < 0 && _pid > 0) {
+        // 子进程没有回收之前 pid 不会被复用，spawn 之后再打开没有竞争
+#ifdef SYS_pidfd_open
+        _pid_fd = int(::syscall(SYS_pidfd_open, _pid, 0));
+#endif
+    }
+    return _pid_fd;
+}
+
+bool Process::Command::reap(int options)
+{
+    int res;
+    do {
+        res = ::waitpid(_pid, &_result._ret_code, options);
+    } while (res < 0 && errno == EINTR);
+    if (res == 0) {
+        return false;
+    }
+    if (res != _pid) {
+        _result._ret_code = -1;
+    }
+    _pid = 0;
+    Result::closeFd(_pid_fd);
+    return true;
 }
 
-void Process::Result::initPipe()
+void Process::Result::initPipe(size_t pipe_size)
 {
     // 初始化3组管道，分别作为子进程的标准输入、标准输出、标准错误
-    int res = pipe(_input_pipe);
+    // 全部带有 O_CLOEXEC，复制到子进程 0、1、2 的描述符不带该标志，其余的在 exec 时自动关闭
+    int res = pipe2(_input_pipe, O_CLOEXEC);
     if (res == -1) {
         _status = 1;
         perror("create input pipe error");
         return;
     }
-    res = pipe(_output_pipe);
+    res = pipe2(_output_pipe, O_CLOEXEC);
     if (res == -1) {
         _status = 2;
         perror("create output pipe error");
         return;
     }
-    res = pipe(_error_pipe);
+    res = pipe2(_error_pipe, O_CLOEXEC);
     if (res == -1) {
         _status = 3;
         perror("create error pipe error");
         return;
     }
     _status = 4;
+    if (pipe_size != 0) {
+        // 失败时保持默认容量
+        ::fcntl(_input_pipe[1], F_SETPIPE_SZ, int(pipe_size));
+        ::fcntl(_output_pipe[0], F_SETPIPE_SZ, int(pipe_size));
+        ::fcntl(_error_pipe[0], F_SETPIPE_SZ, int(pipe_size));
+    }
 }
 
 void Process::Result::initInChild() const
 {
-    // 根据状态决定关闭哪些管道
+    // 根据状态决定重定向哪些管道，dup2 原子地关闭并替换标准输入输出
     if (_status > 1) {
-        // 子进程标准输入不需要写入，所以可以关闭写入端
-        ::close(_input_pipe[1]);
-        // 首先关闭标准输入，然后复制管道到标准输入实现重定向，下同
-        ::close(0);
-        dup(_input_pipe[0]);
+        ::dup2(_input_pipe[0], 0);
         if (_status > 2) {
-            // 标准输出和错误不需要读取，关闭读取端
-            ::close(_output_pipe[0]);
-            ::close(1);
-            dup(_output_pipe[1]);
+            ::dup2(_output_pipe[1], 1);
             if (_status > 3) {
-                ::close(_error_pipe[0]);
-                ::close(2);
-                dup(_error_pipe[1]);
+                ::dup2(_error_pipe[1], 2);
             }
         }
     }
 }
 
-void Process::Result::initInParent() const
+void Process::Result::initFileActions(posix_spawn_file_actions_t* actions) const
 {
+    // 和 initInChild 相同，在子进程 exec 之前执行
     if (_status > 1) {
-        // 父进程需要向子进程标准输入写入，关闭标准输入的读取端
-        ::close(_input_pipe[0]);
+        ::posix_spawn_file_actions_adddup2(actions, _input_pipe[0], 0);
         if (_status > 2) {
-            // 需要读取子进程标准输出和错误，所以关闭写入端
-            ::close(_output_pipe[1]);
+            ::posix_spawn_file_actions_adddup2(actions, _output_pipe[1], 1);
             if (_status > 3) {
-                ::close(_error_pipe[1]);
+                ::posix_spawn_file_actions_adddup2(actions, _error_pipe[1], 2);
             }
         }
     }
 }
 
-void Process::Result::writeToInput(std::string &input) const
+void Process::Result::initInParent()
+{
+    // 父进程需要向子进程标准输入写入，关闭标准输入的读取端
+    // 需要读取子进程标准输出和错误，所以关闭写入端
+    closeFd(_input_pipe[0]);
+    closeFd(_output_pipe[1]);
+    closeFd(_error_pipe[1]);
+    for (int fd : {_input_pipe[1], _output_pipe[0], _error_pipe[0]}) {
+        if (fd >= 0) {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+}
+
+bool Process::Result::pushInput(const std::string& input)
 {
-    size_t write_len = 0, total_len = input.length(), len;
-    while (write_len < total_len) {
+    while (_input_offset < input.size()) {
         // 写入标准输入管道的写入端，此函数在父进程执行
-        len = ::write(_input_pipe[1], (input.data() + write_len), (total_len - write_len));
+        ssize_t len = writeNoSigPipe(_input_pipe[1], input.data() + _input_offset, input.size() - _input_offset);
+        if (len > 0) {
+            _input_offset += size_t(len);
+            continue;
+        }
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        // 管道满时等待下次可写，其他错误说明子进程关闭了标准输入，剩余输入丢弃
+        return len < 0 && errno == EAGAIN;
+    }
+    return false;
+}
+
+bool Process::Result::pullOutput(bool error)
+{
+    if (error ? (_error_callback || _error_tail != 0) : bool(_output_callback)) {
+        return streamOutput(error);
+    }
+    return readPipe(error ? _error_pipe[0] : _output_pipe[0], error ? _error_buf : _output_buf);
+}
+
+bool Process::Result::streamOutput(bool error)
+{
+    // 所有读取共用一块缓冲区，内存占用和输出大小无关
+    _read_buf.resize(kReadSize);
+    int fd = error ? _error_pipe[0] : _output_pipe[0];
+    while (true) {
+        ssize_t len = ::read(fd, &_read_buf[0], kReadSize);
         if (len > 0) {
-            write_len += len;
+            dispatch(error, _read_buf.data(), size_t(len));
+            continue;
+        }
+        if (len < 0 && errno == EINTR) {
             continue;
         }
-        break;
+        if (len < 0 && errno == EAGAIN) {
+            return true;
+        }
+        finishStream(error);
+        return false;
+    }
+}
+
+void Process::Result::dispatch(bool error, const char* data, size_t len)
+{
+    if (error && _error_tail != 0) {
+        appendErrorTail(data, len);
+    }
+    auto& callback = error ? _error_callback : _output_callback;
+    if (!callback) {
+        return;
+    }
+    if (!(error ? _error_by_line : _output_by_line)) {
+        callback(data, len);
+        return;
+    }
+    auto& line = error ? _error_line : _output_line;
+    const char* end = data + len;
+    while (data < end) {
+        auto lf = static_cast<const char*>(std::memchr(data, '\n', size_t(end - data)));
+        if (lf == nullptr) {
+            line.append(data, end);
+            break;
+        }
+        if (line.empty()) {
+            // 完整的一行直接指向读取缓冲区，不需要拷贝
+            callback(data, size_t(lf - data));
+        } else {
+            line.append(data, lf);
+            callback(line.data(), line.size());
+            line.clear();
+        }
+        data = lf + 1;
+    }
+}
+
+void Process::Result::finishStream(bool error)
+{
+    auto& line = error ? _error_line : _output_line;
+    auto& callback = error ? _error_callback : _output_callback;
+    if (!line.empty()) {
+        // 最后一行没有换行符
+        callback(line.data(), line.size());
+        line.clear();
+    }
+    if (error && _error_head != 0) {
+        std::rotate(_error_buf.begin(), _error_buf.begin() + _error_head, _error_buf.end());
+        _error_head = 0;
+    }
+}
+
+void Process::Result::execFailed(int err)
+{
+    // 和 fork 模式下子进程 perror 后 _exit(1) 的结果相同
+    std::string msg = std::string("exec command error: ") + std::strerror(err) + "\n";
+    if (_status <= 3) {
+        // 没有错误输出管道时子进程直接写到父进程的标准错误
+        ::fputs(msg.c_str(), stderr);
+    } else if (_error_callback || _error_tail != 0) {
+        dispatch(true, msg.data(), msg.size());
+        finishStream(true);
+    } else {
+        _error_buf.append(msg);
+    }
+    _ret_code = W_EXITCODE(1, 0);
+}
+
+void Process::Result::appendErrorTail(const char* data, size_t len)
+{
+    if (len >= _error_tail) {
+        _error_buf.assign(data + len - _error_tail, _error_tail);
+        _error_head = 0;
+        return;
+    }
+    if (_error_buf.size() < _error_tail) {
+        // 没有写满之前直接追加
+        size_t n = std::min(len, _error_tail - _error_buf.size());
+        _error_buf.append(data, n);
+        data += n;
+        len -= n;
+    }
+    // 写满之后覆盖最早的数据
+    while (len > 0) {
+        size_t n = std::min(len, _error_tail - _error_head);
+        std::memcpy(&_error_buf[_error_head], data, n);
+        _error_head = (_error_head + n) % _error_tail;
+        data += n;
+        len -= n;
+    }
+}
+
+bool Process::Result::writeToInput(const std::string& input)
+{
+    if (_input_pipe[1] >= 0 && !pushInput(input)) {
+        // 为了标记输入完成，这里需要关闭管道
+        closeFd(_input_pipe[1]);
+    }
+    return _input_pipe[1] < 0;
+}
+
+void Process::Result::pumpIO(const std::string& input)
+{
+    while (!pipesClosed() && pollIO(input, -1)) {
+    }
+}
+
+bool Process::Result::pollIO(const std::string& input, int timeout, int wake_fd)
+{
+    while (true) {
+        struct pollfd fds[4];
+        int* owners[4];
+        nfds_t count = 0;
+        if (_input_pipe[1] >= 0) {
+            fds[count] = {_input_pipe[1], POLLOUT, 0};
+            owners[count++] = &_input_pipe[1];
+        }
+        if (_output_pipe[0] >= 0) {
+            fds[count] = {_output_pipe[0], POLLIN, 0};
+            owners[count++] = &_output_pipe[0];
+        }
+        if (_error_pipe[0] >= 0) {
+            fds[count] = {_error_pipe[0], POLLIN, 0};
+            owners[count++] = &_error_pipe[0];
+        }
+        if (wake_fd >= 0) {
+            fds[count] = {wake_fd, POLLIN, 0};
+            owners[count++] = nullptr;
+        }
+        if (count == 0) {
+            return true;
+        }
+        if (::poll(fds, count, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::perror("poll pipe error");
+            return false;
+        }
+        for (nfds_t i = 0; i < count; ++i) {
+            if (fds[i].revents == 0 || owners[i] == nullptr) {
+                continue;
+            }
+            bool open;
+            if (owners[i] == &_input_pipe[1]) {
+                open = pushInput(input);
+            } else {
+                open = pullOutput(owners[i] == &_error_pipe[0]);
+            }
+            if (!open) {
+                closeFd(*owners[i]);
+            }
+        }
+        return true;
+    }
+}
+
+void Process::Result::closePipe()
+{
+    for (int* fd : {&_input_pipe[0], &_input_pipe[1], &_output_pipe[0], &_output_pipe[1], &_error_pipe[0], &_error_pipe[1]}) {
+        closeFd(*fd);
+    }
+}
+
+void Process::Result::closeFd(int& fd)
+{
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
     }
-    // 为了标记输入完成，这里需要关闭管道
-    ::close(_input_pipe[1]);
 }